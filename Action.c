@@ -26,6 +26,30 @@ void reverse_action(Action *action) {
 }
 
 
+Move action_to_move(Action action) {
+    // actionを16ビットのMoveに変換する
+    // action_equalで等しいと判定されるActionどうしは, 同じMoveに変換される
+
+    if (action.from_stock)
+        return make_drop(action.from_stock, 5 * action.to_x + action.to_y);
+    return make_move(5 * action.from_x + action.from_y, 5 * action.to_x + action.to_y, action.promotion != 0);
+}
+
+
+Action move_to_action(Move move) {
+    // moveをActionに変換する (action_to_moveの逆変換)
+    // 持ち駒を打つ場合, from_x, from_yには-1を入れる
+
+    int to = move_to(move);
+    if (move_drop(move))
+        return (Action) {move_drop(move), -1, -1, to / 5, to % 5, 0};
+    if (move == NULL_MOVE)
+        return (Action) {};
+    int from = move_from(move);
+    return (Action) {0, from / 5, from % 5, to / 5, to % 5, move_promotion(move)};
+}
+
+
 void action_to_string(Action action, char return_buffer[32]) {
     // actionの表す駒の動きを、「グループ課題: 2回目」のページで指定されているフォーマットに
     // 従った文字列に翻訳し、return_bufferに入れる
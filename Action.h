@@ -3,6 +3,7 @@
 
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "gamedef.h"
 
 
@@ -34,4 +35,58 @@ void action_to_string(Action action, char return_buffer[32]);
 bool string_to_action(const char *action_string, Action *return_action);
 
 
+/*********************************
+ * Moveクラスの定義
+ *********************************/
+
+// 指手を16ビットに詰めて表す型 (Actionの省メモリ版, 探索中に大量に保持する指手に用いる)
+// 第0-4ビット: 移動先のマス(5x + y), 第5-9ビット: 移動元のマス(持ち駒を打つ場合0),
+// 第10-12ビット: 打つ持ち駒の種類(打たない場合0), 第13ビット: 成るか否か
+typedef uint16_t Move;
+
+#define NULL_MOVE ((Move) 0)  // 指手がないことを表す値 ((Action) {}に対応する)
+
+
+/*********************************
+ * Moveクラスのメソッド
+ *********************************/
+
+static inline Move make_move(int from, int to, int promotion) {
+    return (Move) (to | (from << 5) | (promotion << 13));
+}
+
+static inline Move make_drop(int piece, int to) {
+    return (Move) (to | (piece << 10));
+}
+
+static inline int move_to(Move move) {
+    return move & 0x1F;
+}
+
+static inline int move_from(Move move) {
+    return (move >> 5) & 0x1F;
+}
+
+static inline int move_drop(Move move) {
+    return (move >> 10) & 0x7;
+}
+
+static inline int move_promotion(Move move) {
+    return (move >> 13) & 0x1;
+}
+
+static inline Move reverse_move(Move move) {
+    // 盤面を180°回転したときの指手に変換する (reverse_actionのMove版)
+    if (move == NULL_MOVE)
+        return NULL_MOVE;
+    if (move_drop(move))
+        return (Move) ((move & ~0x1F) | (24 - move_to(move)));
+    return (Move) ((move & ~0x3FF) | (24 - move_to(move)) | ((24 - move_from(move)) << 5));
+}
+
+Move action_to_move(Action action);
+
+Action move_to_action(Move move);
+
+
 #endif  /* ACTION_H */
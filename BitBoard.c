@@ -0,0 +1,888 @@
+#include "BitBoard.h"
+#include "generated_tables.h"  // table_generator.c によってビルド時に生成される
+
+
+#define BOARD_MASK 0x1FFFFFFu  // 盤面全体のマスの集合
+#define FILE_MASK  0x0108421u  // y = 0 の筋のマスの集合
+#define RANK_MASK  0x000001Fu  // x = TOP の段のマスの集合
+
+
+static inline SquareSet square_bit_(int x, int y) {
+    return (SquareSet) 1 << (5 * x + y);
+}
+
+
+static inline int pop_square_(SquareSet *s) {
+    // 集合sから番号が最小のマスを取り除き, その番号を返す.
+    int square = __builtin_ctz(*s);
+    *s &= *s - 1;
+    return square;
+}
+
+
+static SquareSet reverse_squares_(SquareSet s) {
+    // マス(x, y)をマス(4 - x, 4 - y)に移す. すなわち, 第iビットを第(24 - i)ビットに移す.
+    s = ((s >> 1) & 0x55555555u) | ((s & 0x55555555u) << 1);
+    s = ((s >> 2) & 0x33333333u) | ((s & 0x33333333u) << 2);
+    s = ((s >> 4) & 0x0F0F0F0Fu) | ((s & 0x0F0F0F0Fu) << 4);
+    s = ((s >> 8) & 0x00FF00FFu) | ((s & 0x00FF00FFu) << 8);
+    s = (s >> 16) | (s << 16);
+    return s >> 7;
+}
+
+
+static SquareSet files_of_(SquareSet s) {
+    // 集合sのマスを含む筋を全て合わせた集合を返す.
+    SquareSet files = (s | s >> 5 | s >> 10 | s >> 15 | s >> 20) & RANK_MASK;
+    return files * FILE_MASK;
+}
+
+
+static inline SquareSet diagonal_attacks_(int square, SquareSet occupied) {
+    // squareから斜めに直線的に動けるマスの集合を返す.
+    SquareSet relevant = occupied & DIAGONAL_MASKS[square];
+    return DIAGONAL_ATTACKS[square][((uint64_t) relevant * DIAGONAL_MAGICS[square]) >> ATTACK_INDEX_SHIFT];
+}
+
+
+static inline SquareSet orthogonal_attacks_(int square, SquareSet occupied) {
+    // squareから縦横に直線的に動けるマスの集合を返す.
+    SquareSet relevant = occupied & ORTHOGONAL_MASKS[square];
+    return ORTHOGONAL_ATTACKS[square][((uint64_t) relevant * ORTHOGONAL_MAGICS[square]) >> ATTACK_INDEX_SHIFT];
+}
+
+
+static inline SquareSet attacks_from_(int color, int piece, int square, SquareSet occupied) {
+    // squareにあるcolorの駒pieceのききを返す.
+    // 直線的なききは, 他の駒とぶつかったマスを含み, その先のマスを含まない.
+    SquareSet attacks = STEP_ATTACKS[color][piece][square];
+    if (piece == KAKU || piece == KAKU + NARI)
+        attacks |= diagonal_attacks_(square, occupied);
+    if (piece == HISHA || piece == HISHA + NARI)
+        attacks |= orthogonal_attacks_(square, occupied);
+    return attacks;
+}
+
+
+SquareSet attacks_from(int color, int piece, int square, SquareSet occupied) {
+    return attacks_from_(color, piece, square, occupied);
+}
+
+
+static SquareSet attackers_to_(const BitBoard *bb, int square, int color, SquareSet occupied) {
+    // squareにききを持つcolorの駒の位置の集合を返す.
+    // squareから逆向きに駒の動きを辿り, そこにある駒を調べる.
+    // 直線的なききはoccupiedを駒の配置として求める.
+    const SquareSet *pieces = bb->pieces[color];
+    int opposite = 1 - color;
+    SquareSet golds = pieces[KIN] | pieces[FU + NARI] | pieces[GIN + NARI];
+    SquareSet attackers = (STEP_ATTACKS[opposite][FU][square] & pieces[FU])
+                          | (STEP_ATTACKS[opposite][GIN][square] & pieces[GIN])
+                          | (STEP_ATTACKS[opposite][KIN][square] & golds)
+                          | (STEP_ATTACKS[opposite][OU][square] & pieces[OU])
+                          | (STEP_ATTACKS[opposite][KAKU + NARI][square] & pieces[KAKU + NARI])
+                          | (STEP_ATTACKS[opposite][HISHA + NARI][square] & pieces[HISHA + NARI]);
+    attackers |= diagonal_attacks_(square, occupied) & (pieces[KAKU] | pieces[KAKU + NARI]);
+    attackers |= orthogonal_attacks_(square, occupied) & (pieces[HISHA] | pieces[HISHA + NARI]);
+    return attackers;
+}
+
+
+bool is_square_attacked(const BitBoard *bb, int square, int color) {
+    // squareにcolorの駒のききがあるかを判定する.
+    return attackers_to_(bb, square, color, bb->occupied[0] | bb->occupied[1]) != 0;
+}
+
+
+bool is_in_check(const BitBoard *bb, int color) {
+    // colorの王に相手の駒のききがあるかを判定する.
+    // 王がない場合はfalseを返す.
+    if (!bb->pieces[color][OU])
+        return false;
+    return is_square_attacked(bb, __builtin_ctz(bb->pieces[color][OU]), 1 - color);
+}
+
+
+static int piece_at_(const BitBoard *bb, int color, int square) {
+    // squareにあるcolorの駒の種類を返す. 駒がない場合はEMPTYを返す.
+    SquareSet s = (SquareSet) 1 << square;
+    if (!(bb->occupied[color] & s))
+        return EMPTY;
+    for (int piece = FU; piece <= MAX_PIECE_NUMBER; piece++) {
+        if (bb->pieces[color][piece] & s)
+            return piece;
+    }
+    return EMPTY;
+}
+
+
+int piece_at(const BitBoard *bb, int color, int square) {
+    return piece_at_(bb, color, square);
+}
+
+
+static inline int promotion_rank_(int color) {
+    // colorの駒が成れる段のx座標を返す.
+    return (color == 0) ? TOP : 4 - TOP;
+}
+
+
+static inline SquareSet last_rank_(int color) {
+    // colorの歩を打てない段 (colorから見た最上段) のマスの集合を返す.
+    return (color == 0) ? RANK_MASK : RANK_MASK << 20;
+}
+
+
+BitBoard to_bitboard(const Board *b) {
+    // Board型の盤面をBitBoard型に変換する.
+
+    BitBoard bb = {};
+
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < 5; j++) {
+            int piece = b->board[i][j];
+            if (piece > 0) {
+                bb.pieces[0][piece] |= square_bit_(i, j);
+                bb.occupied[0] |= square_bit_(i, j);
+            } else if (piece < 0) {
+                bb.pieces[1][-piece] |= square_bit_(i, j);
+                bb.occupied[1] |= square_bit_(i, j);
+            }
+        }
+    }
+
+    for (int i = 0; i < 6; i++) {
+        bb.stock[0][i] = b->next_stock[i];
+        bb.stock[1][i] = b->previous_stock[i];
+    }
+
+    return bb;
+}
+
+
+Board from_bitboard(const BitBoard *bb) {
+    // BitBoard型の盤面をBoard型に変換する.
+
+    Board b = {};
+
+    for (int piece = FU; piece <= MAX_PIECE_NUMBER; piece++) {
+        SquareSet s = bb->pieces[0][piece];
+        while (s) {
+            int square = pop_square_(&s);
+            b.board[square / 5][square % 5] = piece;
+        }
+        s = bb->pieces[1][piece];
+        while (s) {
+            int square = pop_square_(&s);
+            b.board[square / 5][square % 5] = -piece;
+        }
+    }
+
+    for (int i = 0; i < 6; i++) {
+        b.next_stock[i] = bb->stock[0][i];
+        b.previous_stock[i] = bb->stock[1][i];
+    }
+
+    return b;
+}
+
+
+void reverse_bitboard(BitBoard *bb) {
+    // 盤面を反転させる (reverse_boardと同じ)
+    // 手番側と相手側を入れ替え, 各マスを180°回転する
+
+    for (int piece = FU; piece <= MAX_PIECE_NUMBER; piece++) {
+        SquareSet s = bb->pieces[0][piece];
+        bb->pieces[0][piece] = reverse_squares_(bb->pieces[1][piece]);
+        bb->pieces[1][piece] = reverse_squares_(s);
+    }
+
+    SquareSet s = bb->occupied[0];
+    bb->occupied[0] = reverse_squares_(bb->occupied[1]);
+    bb->occupied[1] = reverse_squares_(s);
+
+    for (int i = 0; i < 6; i++) {
+        int temp = bb->stock[0][i];
+        bb->stock[0][i] = bb->stock[1][i];
+        bb->stock[1][i] = temp;
+    }
+}
+
+
+static void update_bitboard_(BitBoard *bb, int color, Move move) {
+    // colorの駒を動かして盤面を更新する (update_boardと同じ)
+    // 一切の反則手のチェックをしないので注意！
+
+    int opposite = 1 - color;
+    int to_square = move_to(move);
+    SquareSet to = (SquareSet) 1 << to_square;
+
+    if (move_drop(move)) {  // 持ち駒を打つ場合
+        bb->pieces[color][move_drop(move)] |= to;
+        bb->occupied[color] |= to;
+        --bb->stock[color][move_drop(move)];
+    } else {  // 駒を動かす場合
+        SquareSet from = (SquareSet) 1 << move_from(move);
+        int piece = piece_at_(bb, color, move_from(move));
+
+        if (bb->occupied[opposite] & to) {  // 移動先に相手の駒がある場合、それを持ち駒に加える
+            int gain = piece_at_(bb, opposite, to_square);
+            bb->pieces[opposite][gain] &= ~to;
+            bb->occupied[opposite] &= ~to;
+            ++bb->stock[color][gain % NARI];
+        }
+
+        bb->pieces[color][piece] &= ~from;
+        if (move_promotion(move) && piece < NARI)
+            piece += NARI;  // 駒を成る指示があれば NARI を加える
+        bb->pieces[color][piece] |= to;
+        bb->occupied[color] ^= from | to;
+    }
+}
+
+
+void update_bitboard(BitBoard *bb, Action action) {
+    update_bitboard_(bb, 0, action_to_move(action));
+}
+
+
+void do_move_bb(BitBoard *bb, int color, Move move) {
+    // colorの指手moveで盤面を更新する. 盤面は反転させない.
+    update_bitboard_(bb, color, move);
+}
+
+
+void undo_move_bb(BitBoard *bb, int color, Move move, int moved_piece, int captured_piece) {
+    /*
+    do_move_bb(bb, color, move)で更新した盤面を元に戻す.
+    moved_pieceは動かした駒 (成る前の駒), captured_pieceは取った駒 (取らなかった場合EMPTY) とする.
+    */
+    int opposite = 1 - color;
+    SquareSet to = (SquareSet) 1 << move_to(move);
+
+    if (move_drop(move)) {  // 持ち駒を打った場合
+        bb->pieces[color][moved_piece] &= ~to;
+        bb->occupied[color] &= ~to;
+        ++bb->stock[color][moved_piece];
+    } else {  // 駒を動かした場合
+        SquareSet from = (SquareSet) 1 << move_from(move);
+        int placed_piece = (move_promotion(move) && moved_piece < NARI) ? moved_piece + NARI : moved_piece;
+        bb->pieces[color][placed_piece] &= ~to;
+        bb->pieces[color][moved_piece] |= from;
+        bb->occupied[color] ^= from | to;
+
+        if (captured_piece != EMPTY) {
+            bb->pieces[opposite][captured_piece] |= to;
+            bb->occupied[opposite] |= to;
+            --bb->stock[color][captured_piece % NARI];
+        }
+    }
+}
+
+
+static int add_piece_moves_(int color, int piece, int from, SquareSet to_set, Move moves[LEN_ACTIONS],
+                            int end_index) {
+    /*
+    fromにあるcolorの駒pieceを, to_setの各マスに動かす指手をmovesに追加する.
+    駒が成れるときは成る手も追加する. ただし, 歩が成れるときは必ず成る.
+    返り値 = end_index + 追加した指手の個数
+    */
+    int rank = promotion_rank_(color);
+    while (to_set) {
+        int to = pop_square_(&to_set);
+        if (piece <= GIN && (to / 5 == rank || from / 5 == rank)) {
+            if (piece != FU)
+                // 角, 飛, 銀は成らない手も追加する.
+                moves[end_index++] = make_move(from, to, 0);
+            // 歩が成れるときは必ず成る.
+            moves[end_index++] = make_move(from, to, 1);
+        } else {
+            moves[end_index++] = make_move(from, to, 0);
+        }
+    }
+    return end_index;
+}
+
+
+static int add_move_actions_bb_(const BitBoard *bb, int color, Move moves[LEN_ACTIONS], int end_index) {
+    /*
+    colorの盤面上の駒を動かす指手をmovesに追加する.
+    add_move_actionsとadd_promotionsを合わせたものに相当する.
+    返り値 = end_index + 追加した指手の個数
+    */
+    SquareSet occupied = bb->occupied[0] | bb->occupied[1];
+    SquareSet movable = ~bb->occupied[color] & BOARD_MASK;
+
+    for (int piece = FU; piece <= MAX_PIECE_NUMBER; piece++) {
+        SquareSet from_set = bb->pieces[color][piece];
+        while (from_set) {
+            int from = pop_square_(&from_set);
+            SquareSet to_set = attacks_from_(color, piece, from, occupied) & movable;
+            end_index = add_piece_moves_(color, piece, from, to_set, moves, end_index);
+        }
+    }
+    return end_index;
+}
+
+
+static int add_drop_actions_bb_(const BitBoard *bb, int color, SquareSet targets, Move moves[LEN_ACTIONS],
+                                int end_index) {
+    /*
+    colorの持ち駒をtargetsの空きマスに打つ指手をmovesに追加する.
+    歩を最上段に打てないこと, 二歩に注意する.
+    ここでは打ち歩詰めについては考えない.
+    返り値 = end_index + 追加した指手の個数
+    */
+    SquareSet empty = targets & ~(bb->occupied[0] | bb->occupied[1]) & BOARD_MASK;
+    SquareSet pawn_droppable = empty & ~last_rank_(color) & ~files_of_(bb->pieces[color][FU]);
+
+    while (empty) {
+        int to = pop_square_(&empty);
+        for (int k = FU; k < 6; k++) {
+            if (!bb->stock[color][k])
+                continue;
+            if (k == FU && !(pawn_droppable & ((SquareSet) 1 << to)))
+                continue;
+            moves[end_index++] = make_drop(k, to);
+        }
+    }
+    return end_index;
+}
+
+
+static int add_evasion_actions_bb_(const BitBoard *bb, int color, SquareSet checkers, Move moves[LEN_ACTIONS],
+                                   int end_index) {
+    /*
+    colorが王手されているときに, 王手を回避する指手の候補をmovesに追加する.
+    王を動かす手, 王手している駒を取る手, 飛び駒の王手の間に駒を動かす手や打つ手のみを列挙する.
+    王手放置にならないかどうかは別に判定する必要がある.
+    返り値 = end_index + 追加した指手の個数
+    */
+    SquareSet occupied = bb->occupied[0] | bb->occupied[1];
+    SquareSet movable = ~bb->occupied[color] & BOARD_MASK;
+    int king = __builtin_ctz(bb->pieces[color][OU]);
+
+    // 王を動かす手
+    end_index = add_piece_moves_(color, OU, king, STEP_ATTACKS[color][OU][king] & movable, moves, end_index);
+
+    if (checkers & (checkers - 1))
+        // 両王手のときは王を動かすしかない.
+        return end_index;
+
+    // 王手している駒を取る手と, 王手している駒との間に駒を動かす手
+    int checker = __builtin_ctz(checkers);
+    SquareSet targets = checkers | BETWEEN[king][checker];
+    for (int piece = FU; piece <= MAX_PIECE_NUMBER; piece++) {
+        if (piece == OU)
+            continue;
+        SquareSet from_set = bb->pieces[color][piece];
+        while (from_set) {
+            int from = pop_square_(&from_set);
+            SquareSet to_set = attacks_from_(color, piece, from, occupied) & targets;
+            end_index = add_piece_moves_(color, piece, from, to_set, moves, end_index);
+        }
+    }
+
+    // 王手している駒との間に駒を打つ手
+    return add_drop_actions_bb_(bb, color, BETWEEN[king][checker], moves, end_index);
+}
+
+
+static bool is_king_safe_after_(const BitBoard *bb, int color, Move move) {
+    // colorがmoveを行った後に, colorの王に相手の駒のききがないかを判定する.
+    // 盤面は更新せず, 駒の配置の変化だけを考慮してききを調べる.
+    SquareSet to = (SquareSet) 1 << move_to(move);
+    SquareSet occupied = bb->occupied[0] | bb->occupied[1] | to;
+    SquareSet king_set = bb->pieces[color][OU];
+
+    if (!move_drop(move)) {
+        SquareSet from = (SquareSet) 1 << move_from(move);
+        occupied &= ~from;
+        if (king_set & from)
+            king_set = to;  // 王を動かす場合
+    }
+
+    if (!king_set)
+        // 王がないとき
+        return true;
+
+    // 取られる駒 (toにある駒) のききは除く.
+    return !(attackers_to_(bb, __builtin_ctz(king_set), 1 - color, occupied) & ~to);
+}
+
+
+static SquareSet pinned_pieces_(const BitBoard *bb, int color, int king, SquareSet occupied, SquareSet pin_lines[25]) {
+    /*
+    相手の飛び駒とcolorの王kingとの間にある, colorの唯一の駒 (ピンされた駒) の集合を返す.
+    pin_linesがNULLでなければ, ピンされた駒がいるマスsquareについて, pin_lines[square]に
+    その駒が動けるマス (王と飛び駒の間のマス及び飛び駒のマス) の集合を代入する.
+    */
+    const SquareSet *enemies = bb->pieces[1 - color];
+    SquareSet snipers = (diagonal_attacks_(king, 0) & (enemies[KAKU] | enemies[KAKU + NARI]))
+                        | (orthogonal_attacks_(king, 0) & (enemies[HISHA] | enemies[HISHA + NARI]));
+    SquareSet pinned = 0;
+
+    while (snipers) {
+        int sniper = pop_square_(&snipers);
+        SquareSet blockers = BETWEEN[king][sniper] & occupied;
+        if (blockers && !(blockers & (blockers - 1)) && (blockers & bb->occupied[color])) {
+            pinned |= blockers;
+            if (pin_lines != NULL)
+                pin_lines[__builtin_ctz(blockers)] = BETWEEN[king][sniper] | ((SquareSet) 1 << sniper);
+        }
+    }
+    return pinned;
+}
+
+
+static bool is_drop_pawn_mate_(const BitBoard *bb, int color, int square) {
+    /*
+    colorがsquareに歩を打って相手の王に王手したとき, 打ち歩詰めになるかを判定する.
+    相手の指手を列挙せずに, 王が逃げられるか, 打った歩をピンされていない駒で取れるかだけを調べる.
+    歩は王に隣接しているので, 間に駒を打ったり動かしたりして防ぐことはできない.
+    */
+    int opposite = 1 - color;
+    int king = __builtin_ctz(bb->pieces[opposite][OU]);
+    SquareSet occupied = bb->occupied[0] | bb->occupied[1] | ((SquareSet) 1 << square);
+
+    // 王が逃げられるか (打った歩のききは王のいるマスだけなので, 歩は盤上にないものとして調べてよい)
+    SquareSet escapes = STEP_ATTACKS[opposite][OU][king] & ~bb->occupied[opposite] & BOARD_MASK;
+    SquareSet occupied_without_king = occupied & ~((SquareSet) 1 << king);
+    while (escapes) {
+        if (!attackers_to_(bb, pop_square_(&escapes), color, occupied_without_king))
+            return false;
+    }
+
+    // 打った歩を王以外の駒で取れるか
+    SquareSet capturers = attackers_to_(bb, square, opposite, occupied) & ~bb->pieces[opposite][OU];
+    if (capturers & ~pinned_pieces_(bb, opposite, king, occupied, NULL))
+        return false;
+
+    return true;
+}
+
+
+static int get_all_moves_bb_(const BitBoard *bb, int color, Move all_moves[LEN_ACTIONS]) {
+    /*
+    colorが選択可能な指手を全列挙する.
+    王手放置や打ち歩詰めに注意する.
+    王手されているときは, 王手を回避する指手の候補だけを調べる.
+    */
+
+    // 選択可能な指手の候補を全列挙する.
+    int len_tmp_moves = 0;
+    SquareSet checkers = 0;
+    if (bb->pieces[color][OU]) {
+        SquareSet occupied = bb->occupied[0] | bb->occupied[1];
+        checkers = attackers_to_(bb, __builtin_ctz(bb->pieces[color][OU]), 1 - color, occupied);
+    }
+    if (checkers) {
+        len_tmp_moves = add_evasion_actions_bb_(bb, color, checkers, all_moves, len_tmp_moves);
+    } else {
+        len_tmp_moves = add_move_actions_bb_(bb, color, all_moves, len_tmp_moves);
+        len_tmp_moves = add_drop_actions_bb_(bb, color, BOARD_MASK, all_moves, len_tmp_moves);
+    }
+
+    // 王手放置や打ち歩詰めにならない指手だけを前に詰めて残す.
+    int end_index = 0;
+    for (int i = 0; i < len_tmp_moves; i++) {
+        Move move = all_moves[i];
+        if (!is_king_safe_after_(bb, color, move))
+            // 王手放置のとき
+            continue;
+        if (move_drop(move) == FU && (STEP_ATTACKS[color][FU][move_to(move)] & bb->pieces[1 - color][OU])) {
+            // 歩を打って王手するとき
+            if (is_drop_pawn_mate_(bb, color, move_to(move)))
+                // 打ち歩詰めのとき
+                continue;
+        }
+        all_moves[end_index++] = move;
+    }
+
+    return end_index;
+}
+
+
+static inline int add_legal_moves_(const BitBoard *bb, int color, SquareSet to_mask, bool with_drops,
+                                   Move moves[LEN_ACTIONS], int end_index) {
+    /*
+    colorの合法手のうち, 移動先がto_maskに含まれるものをmovesに追加する. with_dropsが偽なら持ち駒を打つ手は追加しない.
+    王手している駒とピンされた駒を最初に求めておき, 合法手だけを直接生成する.
+    打ち歩詰めだけは, 歩を打って王手する手について個別に判定する.
+    返り値 = end_index + 追加した指手の個数
+    */
+    int opposite = 1 - color;
+    if (!bb->pieces[color][OU]) {
+        // 王がないとき (通常の対局では起こらない)
+        Move all_moves[LEN_ACTIONS];
+        int len_all_moves = get_all_moves_bb_(bb, color, all_moves);
+        for (int i = 0; i < len_all_moves; i++) {
+            if ((to_mask & ((SquareSet) 1 << move_to(all_moves[i]))) && (with_drops || !move_drop(all_moves[i])))
+                moves[end_index++] = all_moves[i];
+        }
+        return end_index;
+    }
+
+    SquareSet occupied = bb->occupied[0] | bb->occupied[1];
+    SquareSet movable = ~bb->occupied[color] & to_mask & BOARD_MASK;
+    int king = __builtin_ctz(bb->pieces[color][OU]);
+    SquareSet checkers = attackers_to_(bb, king, opposite, occupied);
+
+    // 王を動かす手 (王がいなくなった後の配置でききを調べる)
+    SquareSet king_to_set = STEP_ATTACKS[color][OU][king] & movable;
+    SquareSet safe = 0;
+    while (king_to_set) {
+        int to = pop_square_(&king_to_set);
+        if (!attackers_to_(bb, to, opposite, occupied & ~((SquareSet) 1 << king)))
+            safe |= (SquareSet) 1 << to;
+    }
+    end_index = add_piece_moves_(color, OU, king, safe, moves, end_index);
+
+    if (checkers & (checkers - 1))
+        // 両王手のときは王を動かすしかない.
+        return end_index;
+
+    // 王以外の駒を動かす手
+    // 王手されているときは, 王手している駒を取る手と間に駒を動かす手に限る.
+    SquareSet targets = movable;
+    SquareSet drop_targets = to_mask;
+    if (checkers) {
+        drop_targets &= BETWEEN[king][__builtin_ctz(checkers)];
+        targets &= checkers | BETWEEN[king][__builtin_ctz(checkers)];
+    }
+    SquareSet pin_lines[25];
+    SquareSet pinned = pinned_pieces_(bb, color, king, occupied, pin_lines);
+    for (int piece = FU; piece <= MAX_PIECE_NUMBER; piece++) {
+        if (piece == OU)
+            continue;
+        SquareSet from_set = bb->pieces[color][piece];
+        while (from_set) {
+            int from = pop_square_(&from_set);
+            SquareSet to_set = attacks_from_(color, piece, from, occupied) & targets;
+            if (pinned & ((SquareSet) 1 << from))
+                to_set &= pin_lines[from];
+            end_index = add_piece_moves_(color, piece, from, to_set, moves, end_index);
+        }
+    }
+
+    if (!with_drops)
+        return end_index;
+
+    // 持ち駒を打つ手
+    int drop_index = end_index;
+    end_index = add_drop_actions_bb_(bb, color, drop_targets, moves, end_index);
+
+    // 打ち歩詰めになる手を取り除く.
+    // 歩を打つと王手になるマスは, 相手の王のマスから相手の歩が進むマスである.
+    SquareSet pawn_check_square = bb->pieces[opposite][OU]
+                                  ? STEP_ATTACKS[opposite][FU][__builtin_ctz(bb->pieces[opposite][OU])] : 0;
+    for (int i = drop_index; i < end_index; i++) {
+        Move move = moves[i];
+        if (move_drop(move) == FU && (pawn_check_square & ((SquareSet) 1 << move_to(move)))) {
+            if (is_drop_pawn_mate_(bb, color, move_to(move))) {
+                // 打ち歩詰めのとき
+                moves[i] = moves[--end_index];
+                break;
+            }
+        }
+    }
+
+    return end_index;
+}
+
+
+static int add_legal_moves_for_(const BitBoard *bb, int color, SquareSet to_mask, bool with_drops,
+                                Move moves[LEN_ACTIONS], int end_index) {
+    // add_legal_moves_を先手向き (color = 0) と後手向き (color = 1) のそれぞれに特殊化して呼び出す.
+    // colorを定数として展開させることで, 向きに関する分岐をコンパイル時に取り除く.
+    if (color == 0)
+        return add_legal_moves_(bb, 0, to_mask, with_drops, moves, end_index);
+    return add_legal_moves_(bb, 1, to_mask, with_drops, moves, end_index);
+}
+
+
+static int get_legal_moves_bb_(const BitBoard *bb, int color, Move all_moves[LEN_ACTIONS]) {
+    // colorが選択可能な指手を全列挙する (王手放置となる指手を1つずつ試さずに合法手だけを生成する).
+    return add_legal_moves_for_(bb, color, BOARD_MASK, true, all_moves, 0);
+}
+
+
+static bool gives_check_(const BitBoard *bb, int color, Move move) {
+    // colorがmoveを行うと相手の王に王手がかかるかを判定する (空き王手も含む).
+    const SquareSet enemy_king = bb->pieces[1 - color][OU];
+    if (!enemy_king)
+        return false;
+
+    int king = __builtin_ctz(enemy_king);
+    int to = move_to(move);
+    SquareSet occupied = bb->occupied[0] | bb->occupied[1] | ((SquareSet) 1 << to);
+
+    if (move_drop(move))
+        return (attacks_from_(color, move_drop(move), to, occupied) & enemy_king) != 0;
+
+    // 動かした駒による王手
+    int from = move_from(move);
+    int piece = piece_at_(bb, color, from);
+    if (move_promotion(move) && piece < NARI)
+        piece += NARI;
+    occupied &= ~((SquareSet) 1 << from);
+    if (attacks_from_(color, piece, to, occupied) & enemy_king)
+        return true;
+
+    // 動かした駒の後ろにある飛び駒による王手
+    const SquareSet *pieces = bb->pieces[color];
+    SquareSet others = ~((SquareSet) 1 << from);
+    return (diagonal_attacks_(king, occupied) & (pieces[KAKU] | pieces[KAKU + NARI]) & others)
+           || (orthogonal_attacks_(king, occupied) & (pieces[HISHA] | pieces[HISHA + NARI]) & others);
+}
+
+
+int generate_moves_bb(const BitBoard *bb, int color, Move all_moves[LEN_ACTIONS]) {
+    // gamedef.hのMOVE_GENERATORで選ばれているビットボードの実装で, colorの指手を全列挙する.
+#if MOVE_GENERATOR == PIN_AWARE_GENERATOR
+    return get_legal_moves_bb_(bb, color, all_moves);
+#else
+    return get_all_moves_bb_(bb, color, all_moves);
+#endif
+}
+
+
+void init_move_picker(MovePicker *picker, const Board *b) {
+    // 盤面bの手番側の合法手を段階的に生成するMovePickerを初期化する.
+    // この時点では指手を1つも生成しない.
+    BitBoard bb = to_bitboard(b);
+    init_move_picker_bb(picker, &bb, 0);
+}
+
+
+void init_move_picker_bb(MovePicker *picker, const BitBoard *bb, int color) {
+    // ビットボードbbのcolorの合法手を段階的に生成するMovePickerを初期化する.
+    // 盤面を反転させずに, colorから見た向きの指手を生成する.
+    picker->bb = *bb;
+    picker->color = color;
+    picker->stage = PICK_CAPTURES;
+    picker->current_index = 0;
+    picker->end_index = 0;
+    picker->len_moves = 0;
+}
+
+
+Move next_move(MovePicker *picker) {
+    /*
+    次の合法手を返す. 合法手が残っていないときはNULL_MOVEを返す.
+    駒を取る手, 王手をかける手 (駒を打つ手を含む), それ以外の手の順に返し,
+    各段階の指手はその段階に入ったときにはじめて生成する.
+    */
+    const BitBoard *bb = &picker->bb;
+    const int color = picker->color;
+    Move *moves = picker->moves;
+
+    while (picker->current_index == picker->end_index) {
+        switch (picker->stage) {
+            case PICK_CAPTURES:
+                // 駒を取る手
+                picker->len_moves = add_legal_moves_for_(bb, color, bb->occupied[1 - color], false, moves,
+                                                         picker->len_moves);
+                picker->end_index = picker->len_moves;
+                picker->stage = PICK_CHECKS;
+                break;
+            case PICK_CHECKS: {
+                // 駒を取らない手を生成し, 王手をかける手を前に集める.
+                int start_index = picker->len_moves;
+                SquareSet empty = ~(bb->occupied[0] | bb->occupied[1]) & BOARD_MASK;
+                picker->len_moves = add_legal_moves_for_(bb, color, empty, true, moves, start_index);
+                int checks_end = start_index;
+                for (int i = start_index; i < picker->len_moves; i++) {
+                    if (gives_check_(bb, color, moves[i])) {
+                        Move tmp = moves[i];
+                        moves[i] = moves[checks_end];
+                        moves[checks_end++] = tmp;
+                    }
+                }
+                picker->end_index = checks_end;
+                picker->stage = PICK_QUIETS;
+                break;
+            }
+            case PICK_QUIETS:
+                // 残りの指手
+                picker->end_index = picker->len_moves;
+                picker->stage = PICK_END;
+                break;
+            default:
+                return NULL_MOVE;
+        }
+    }
+
+    return moves[picker->current_index++];
+}
+
+
+int get_check_moves_bb(const BitBoard *bb, int color, Move moves[LEN_ACTIONS]) {
+    /*
+    colorの合法手のうち, 相手の王に王手をかける手だけを列挙する.
+    空き王手になる手や, 持ち駒を打って王手する手も含む.
+    持ち駒は, 相手の王のマスから打つ駒の逆向きのききを辿ったマスに打つ手だけを生成する.
+    */
+    int opposite = 1 - color;
+    if (!bb->pieces[opposite][OU])
+        return 0;
+    int king = __builtin_ctz(bb->pieces[opposite][OU]);
+    SquareSet occupied = bb->occupied[0] | bb->occupied[1];
+
+    // 盤上の駒を動かす手 (空き王手も含めてgives_check_で判定する)
+    int len_moves = add_legal_moves_for_(bb, color, BOARD_MASK, false, moves, 0);
+    int end_index = 0;
+    for (int i = 0; i < len_moves; i++) {
+        if (gives_check_(bb, color, moves[i]))
+            moves[end_index++] = moves[i];
+    }
+
+    // 持ち駒を打つ手 (王手になるマスに限って合法手を生成する)
+    SquareSet drop_targets = 0;
+    for (int piece = FU; piece < 6; piece++) {
+        if (bb->stock[color][piece])
+            drop_targets |= attacks_from_(opposite, piece, king, occupied);
+    }
+    drop_targets &= ~occupied;
+    if (!drop_targets)
+        return end_index;
+
+    Move drops[LEN_ACTIONS];
+    int len_drops = add_legal_moves_for_(bb, color, drop_targets, true, drops, 0);
+    for (int i = 0; i < len_drops; i++) {
+        Move move = drops[i];
+        if (move_drop(move) && (attacks_from_(color, move_drop(move), move_to(move), occupied) & bb->pieces[opposite][OU]))
+            moves[end_index++] = move;
+    }
+    return end_index;
+}
+
+
+bool has_legal_move_bb(const BitBoard *bb, int color) {
+    // colorに合法手が1つでもあるかを判定する. 1つ見つけた時点で生成を打ち切る.
+    MovePicker picker = {.bb=*bb, .color=color, .stage=PICK_CAPTURES};
+    return next_move(&picker) != NULL_MOVE;
+}
+
+
+bool is_mating_move_bb(const BitBoard *bb, int color, Move move) {
+    /*
+    colorがmoveを行うと, 相手に合法手が1つもなくなるか (詰むか) を判定する. 千日手は考慮しない.
+    王手をかける手は, 相手の王手を回避する手だけを生成して調べる.
+    王手をかけない手は, 相手が歩以外の持ち駒を打てるときや王を安全なマスに動かせるときは直ちに偽を返す.
+    */
+    int opposite = 1 - color;
+    BitBoard next = *bb;
+    update_bitboard_(&next, color, move);
+
+    if (!gives_check_(bb, color, move)) {
+        // 盤上の駒は高々12枚で空きマスは必ずあるので, 歩以外の持ち駒はどこかに打てる.
+        const int *stock = next.stock[opposite];
+        if (stock[KAKU] || stock[HISHA] || stock[GIN] || stock[KIN])
+            return false;
+
+        // 王を安全なマスに動かせるか
+        if (next.pieces[opposite][OU]) {
+            int king = __builtin_ctz(next.pieces[opposite][OU]);
+            SquareSet occupied = (next.occupied[0] | next.occupied[1]) & ~((SquareSet) 1 << king);
+            SquareSet escapes = STEP_ATTACKS[opposite][OU][king] & ~next.occupied[opposite] & BOARD_MASK;
+            while (escapes) {
+                if (!attackers_to_(&next, pop_square_(&escapes), color, occupied))
+                    return false;
+            }
+        }
+    }
+
+    return !has_legal_move_bb(&next, opposite);
+}
+
+
+bool is_drop_pawn_check_bb(const BitBoard *bb, int color, Move move) {
+    // colorのmoveが歩を打って王手する手であるかを判定する (is_drop_pawn_checkのビットボード版).
+    return move_drop(move) == FU && (STEP_ATTACKS[color][FU][move_to(move)] & bb->pieces[1 - color][OU]);
+}
+
+
+bool is_useful_move_bb(const BitBoard *bb, int color, Move move) {
+    // colorのmoveが有用かどうかを簡単に判定する (is_usefulのビットボード版).
+    // 飛や角が成れるのに成らない指手のみに対しfalseを返す.
+    if (move_drop(move) || move_promotion(move))
+        return true;
+    int piece = piece_at_(bb, color, move_from(move));
+    if (piece != HISHA && piece != KAKU)
+        return true;
+    int rank = promotion_rank_(color);
+    return move_from(move) / 5 != rank && move_to(move) / 5 != rank;
+}
+
+
+static int moves_to_actions_(const Move moves[LEN_ACTIONS], int len_moves, Action actions[LEN_ACTIONS]) {
+    for (int i = 0; i < len_moves; i++)
+        actions[i] = move_to_action(moves[i]);
+    return len_moves;
+}
+
+
+int get_all_moves_bb(const Board *b, Move all_moves[LEN_ACTIONS]) {
+    // get_all_actionsのビットボードによる実装
+    // 列挙される指手の集合はget_all_actionsと同じである (順番は異なる)
+    BitBoard bb = to_bitboard(b);
+    return get_all_moves_bb_(&bb, 0, all_moves);
+}
+
+
+int get_legal_moves_bb(const Board *b, Move all_moves[LEN_ACTIONS]) {
+    // get_all_actionsのピンを考慮したビットボードによる実装
+    // 指手を1つずつ試さずに合法手だけを生成する (列挙される指手の集合はget_all_actionsと同じ)
+    BitBoard bb = to_bitboard(b);
+    return get_legal_moves_bb_(&bb, 0, all_moves);
+}
+
+
+int get_useful_moves_bb(const Board *b, Move moves[LEN_ACTIONS]) {
+    // get_useful_actionsのビットボードによる実装
+
+    // 駒を取る手, 王手をかける手, それ以外の手の順に列挙しながら, 相手の王を詰ませられるかを判定する.
+    MovePicker picker;
+    init_move_picker(&picker, b);
+    Move all_moves[LEN_ACTIONS];
+    int len_all_moves = 0;
+    for (Move move = next_move(&picker); move != NULL_MOVE; move = next_move(&picker)) {
+        BitBoard next_bb = picker.bb;
+        update_bitboard_(&next_bb, 0, move);
+        if (!has_legal_move_bb(&next_bb, 1)) {
+            // moveを行うと相手の王が詰むとき
+            moves[0] = move;
+            return 1;
+        }
+        all_moves[len_all_moves++] = move;
+    }
+
+    // ほぼ明らかに無駄な指手以外を列挙する.
+    int end_index = 0;
+    for (int i = 0; i < len_all_moves; i++) {
+        Action action = move_to_action(all_moves[i]);
+        if (is_useful(b, &action))
+            moves[end_index++] = all_moves[i];
+    }
+
+    return end_index;
+}
+
+
+int get_all_actions_bb(const Board *b, Action all_actions[LEN_ACTIONS]) {
+    Move all_moves[LEN_ACTIONS];
+    return moves_to_actions_(all_moves, get_all_moves_bb(b, all_moves), all_actions);
+}
+
+
+int get_legal_actions_bb(const Board *b, Action all_actions[LEN_ACTIONS]) {
+    Move all_moves[LEN_ACTIONS];
+    return moves_to_actions_(all_moves, get_legal_moves_bb(b, all_moves), all_actions);
+}
+
+
+int get_useful_actions_bb(const Board *b, Action actions[LEN_ACTIONS]) {
+    Move moves[LEN_ACTIONS];
+    return moves_to_actions_(moves, get_useful_moves_bb(b, moves), actions);
+}
@@ -0,0 +1,98 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gamedef.h"
+#include "Action.h"
+#include "Board.h"
+
+
+/*********************************
+ * BitBoardクラスの定義
+ *********************************/
+
+typedef uint32_t SquareSet;  // マスの集合, マス(x, y)を第(5x + y)ビットで表す
+
+typedef struct {                                // 盤面をビットボードで表す構造体
+    SquareSet pieces[2][MAX_PIECE_NUMBER + 1];  // 駒の種類ごとの位置 ([0]は上向きに進む側, [1]はその相手, [*][EMPTY]は未使用)
+    SquareSet occupied[2];                      // 各プレイヤーの駒がある位置
+    int stock[2][6];                            // 持ち駒 ([0]は上向きに進む側, [1]はその相手)
+} BitBoard;  // Boardから変換した場合は[0]が手番側となる
+
+
+typedef enum {     // MovePickerが指手を生成する段階
+    PICK_CAPTURES,  // 駒を取る手
+    PICK_CHECKS,    // 王手をかける手
+    PICK_QUIETS,    // それ以外の手
+    PICK_END        // 全ての指手を返し終えた
+} PickStage;
+
+typedef struct {              // 合法手を段階的に生成して1つずつ返す構造体
+    BitBoard bb;              // 指手を生成する盤面
+    int color;                // 指手を生成する側 (BitBoardの添字)
+    Move moves[LEN_ACTIONS];  // 生成した指手
+    PickStage stage;          // 次に生成する段階
+    int current_index;        // 次に返す指手のインデックス
+    int end_index;            // 現在の段階で返す指手の終端
+    int len_moves;            // 生成済みの指手の個数
+} MovePicker;
+
+
+/*********************************
+ * BitBoardクラスのメソッド
+ *********************************/
+
+BitBoard to_bitboard(const Board *b);
+
+Board from_bitboard(const BitBoard *bb);
+
+void reverse_bitboard(BitBoard *bb);
+
+SquareSet attacks_from(int color, int piece, int square, SquareSet occupied);
+
+bool is_square_attacked(const BitBoard *bb, int square, int color);
+
+bool is_in_check(const BitBoard *bb, int color);
+
+void update_bitboard(BitBoard *bb, Action action);
+
+void do_move_bb(BitBoard *bb, int color, Move move);
+
+void undo_move_bb(BitBoard *bb, int color, Move move, int moved_piece, int captured_piece);
+
+int piece_at(const BitBoard *bb, int color, int square);
+
+int get_all_moves_bb(const Board *b, Move all_moves[LEN_ACTIONS]);
+
+int get_legal_moves_bb(const Board *b, Move all_moves[LEN_ACTIONS]);
+
+int get_useful_moves_bb(const Board *b, Move moves[LEN_ACTIONS]);
+
+int generate_moves_bb(const BitBoard *bb, int color, Move all_moves[LEN_ACTIONS]);
+
+void init_move_picker(MovePicker *picker, const Board *b);
+
+void init_move_picker_bb(MovePicker *picker, const BitBoard *bb, int color);
+
+Move next_move(MovePicker *picker);
+
+int get_check_moves_bb(const BitBoard *bb, int color, Move moves[LEN_ACTIONS]);
+
+bool has_legal_move_bb(const BitBoard *bb, int color);
+
+bool is_mating_move_bb(const BitBoard *bb, int color, Move move);
+
+bool is_drop_pawn_check_bb(const BitBoard *bb, int color, Move move);
+
+bool is_useful_move_bb(const BitBoard *bb, int color, Move move);
+
+int get_all_actions_bb(const Board *b, Action all_actions[LEN_ACTIONS]);
+
+int get_legal_actions_bb(const Board *b, Action all_actions[LEN_ACTIONS]);
+
+int get_useful_actions_bb(const Board *b, Action actions[LEN_ACTIONS]);
+
+
+#endif  /* BITBOARD_H */
@@ -1,10 +1,15 @@
 #include "Board.h"
+#include "BitBoard.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
 
+// board_equalでmemcmpを使うため, Boardにパディングがないことを保証する
+_Static_assert(sizeof(Board) == 25 + 6 + 6, "Board must not contain padding");
+
+
 Board create_board(void) {
     // Board型の盤面を作って初期化し、それを戻り値として返す
     // first_mover引数は先手を表し、USER か AI のいずれかである
@@ -94,47 +99,27 @@ void print_board_for_debug(const Board *b) {
 bool board_equal(const Board *b1, const Board *b2) {
     // 2つの盤面が等しければ1を、等しくなければ0を返す
     // 次に打つプレイヤーが誰かは考慮しない
+    // Boardはパディングのないバイト列なので, まとめて比較する
 
-    for (int i = 0; i < 5; ++i)
-        for (int j = 0; j < 5; ++j)
-            if (b1->board[i][j] != b2->board[i][j])
-                return false;
-
-    for (int i = 0; i < 6; ++i) {
-        if (b1->next_stock[i] != b2->next_stock[i])
-            return false;
-        if (b1->previous_stock[i] != b2->previous_stock[i])
-            return false;
-    }
-
-    return true;
+    return memcmp(b1, b2, sizeof(Board)) == 0;
 }
 
 
 void reverse_board(Board *b) {
     // 盤面を反転させる
     // b.board[5][5]の全要素に-1を掛けて180°回転する
-
-    for (int i = 0; i < 5; i++) {
-        for (int j = 0; j < 5; j++) {
-            b->board[i][j] *= -1;
-        }
-    }
-    for (int i = 0; i < 5; i++) {
-        for (int j = 0; j < 3; j++) {
-            if (j == 2 && i >= 3) continue;
-            else {
-                int temp = b->board[i][j];
-                b->board[i][j] = b->board[4 - i][4 - j];
-                b->board[4 - i][4 - j] = temp;
-            }
-        }
-    }
-    for (int i = 0; i < 6; i++) {
-        int temp = b->previous_stock[i];
-        b->previous_stock[i] = b->next_stock[i];
-        b->next_stock[i] = temp;
-    }
+    // 180°回転は25マスを1列に並べたときの逆順なので, 分岐のないループで書ける
+
+    const int8_t *cells = &b->board[0][0];
+    int8_t reversed[25];
+    for (int i = 0; i < 25; i++)
+        reversed[i] = (int8_t) -cells[24 - i];
+    memcpy(b->board, reversed, sizeof(reversed));
+
+    uint8_t temp[6];
+    memcpy(temp, b->previous_stock, sizeof(temp));
+    memcpy(b->previous_stock, b->next_stock, sizeof(temp));
+    memcpy(b->next_stock, temp, sizeof(temp));
 }
 
 
@@ -359,38 +344,22 @@ static int add_drop_actions(const Board *b, Action actions[LEN_ACTIONS], int end
 
 bool is_checking(const Board *b) {
     // 手番側が王手しているかを判定する.
-
-    // 可能な駒移動の指手を列挙する.
-    Action all_actions[LEN_ACTIONS];
-    int end_index = add_move_actions(b, all_actions, 0);
-
-    // 相手の王の位置を取得する.
-    int x, y;
-    get_piece_position(b, &x, &y, -OU);
-
-    // 相手の王をとれる状態かを判定する.
-    for (int i = 0; i < end_index; i++) {
-        if (all_actions[i].to_x == x && all_actions[i].to_y == y)
-            return true;
-    }
-    return false;
+    // 指手を列挙せず, 相手の王のマスに手番側の駒のききがあるかを調べる.
+    BitBoard bb = to_bitboard(b);
+    return is_in_check(&bb, 1);
 }
 
 
-// reverse_boardを使用
 bool is_checked(const Board *b) {
-    /*
-    手番側が王手されているかを判定する.
-    引数のbはconstではなく, 直接編集されることに注意する.
-    */
-    Board b_copy = *b;
-    reverse_board(&b_copy);
-    return is_checking(&b_copy);
+    // 手番側が王手されているかを判定する.
+    // 指手を列挙せず, 手番側の王のマスに相手の駒のききがあるかを調べる.
+    BitBoard bb = to_bitboard(b);
+    return is_in_check(&bb, 0);
 }
 
 
 // update_boardを使用
-int get_all_actions(const Board *b, Action all_actions[LEN_ACTIONS]) {
+int get_all_actions_by_scan(const Board *b, Action all_actions[LEN_ACTIONS]) {
     /*
     選択可能な指手を全列挙する.
     王手放置や打ち歩詰めに注意する.
@@ -418,7 +387,7 @@ int get_all_actions(const Board *b, Action all_actions[LEN_ACTIONS]) {
             update_board(&next_b, tmp_actions[i]);
             reverse_board(&next_b);
             Action next_actions[LEN_ACTIONS];
-            if (get_all_actions(&next_b, next_actions) == 0)
+            if (get_all_actions_by_scan(&next_b, next_actions) == 0)
                 // 打ち歩詰めのとき
                 continue;
         }
@@ -429,17 +398,40 @@ int get_all_actions(const Board *b, Action all_actions[LEN_ACTIONS]) {
 }
 
 
-static int get_number_of_moves(const Board *b) {
-    // 手番側の可能な指手の個数を返す.
+int get_all_actions(const Board *b, Action all_actions[LEN_ACTIONS]) {
+    // 選択可能な指手を全列挙する.
+    // 実装はgamedef.hのMOVE_GENERATORで切り替える.
+#if MOVE_GENERATOR == SCAN_GENERATOR
+    return get_all_actions_by_scan(b, all_actions);
+#elif MOVE_GENERATOR == BITBOARD_GENERATOR
+    return get_all_actions_bb(b, all_actions);
+#else
+    return get_legal_actions_bb(b, all_actions);
+#endif
+}
+
+
+int get_all_moves(const Board *b, Move all_moves[LEN_ACTIONS]) {
+    // get_all_actionsと同じ指手をMove型で列挙する.
+#if MOVE_GENERATOR == SCAN_GENERATOR
     Action all_actions[LEN_ACTIONS];
-    return get_all_actions(b, all_actions);
+    int len_all_actions = get_all_actions_by_scan(b, all_actions);
+    for (int i = 0; i < len_all_actions; i++)
+        all_moves[i] = action_to_move(all_actions[i]);
+    return len_all_actions;
+#elif MOVE_GENERATOR == BITBOARD_GENERATOR
+    return get_all_moves_bb(b, all_moves);
+#else
+    return get_legal_moves_bb(b, all_moves);
+#endif
 }
 
 
 bool is_checkmate(const Board *b) {
     // 詰みなら1, 詰みでないなら0を返す.
-    // 手番側に可能な指手があるかどうかを探す.
-    return get_number_of_moves(b) == 0;
+    // 手番側に可能な指手があるかどうかを探す (1つ見つけた時点で打ち切る).
+    BitBoard bb = to_bitboard(b);
+    return !has_legal_move_bb(&bb, 0);
 }
 
 
@@ -483,7 +475,7 @@ bool is_useful(const Board *b, const Action *action) {
 
 
 // update_boardとreverse_boardを使用
-int get_useful_actions(const Board *b, Action actions[LEN_ACTIONS]) {
+int get_useful_actions_by_scan(const Board *b, Action actions[LEN_ACTIONS]) {
     /*
     有用な指手を列挙する.
     相手の王を詰ませられるときは, その1手を代入する.
@@ -492,14 +484,15 @@ int get_useful_actions(const Board *b, Action actions[LEN_ACTIONS]) {
 
     // 選択可能な指手を全て列挙する.
     Action all_actions[LEN_ACTIONS];
-    int len_all_actions = get_all_actions(b, all_actions);
+    int len_all_actions = get_all_actions_by_scan(b, all_actions);
 
     // 相手の王を詰ませられるかを判定する.
     for (int i = 0; i < len_all_actions; i++) {
         Board next_b = *b;
         update_board(&next_b, all_actions[i]);
         reverse_board(&next_b);
-        if (is_checkmate(&next_b)) {
+        Action next_actions[LEN_ACTIONS];
+        if (get_all_actions_by_scan(&next_b, next_actions) == 0) {
             // all_actions[i]を行うと相手の王が詰むとき
             actions[0] = all_actions[i];
             return 1;
@@ -517,10 +510,36 @@ int get_useful_actions(const Board *b, Action actions[LEN_ACTIONS]) {
 }
 
 
+int get_useful_actions(const Board *b, Action actions[LEN_ACTIONS]) {
+    // 有用な指手を列挙する.
+    // 実装はgamedef.hのMOVE_GENERATORで切り替える.
+#if MOVE_GENERATOR == SCAN_GENERATOR
+    return get_useful_actions_by_scan(b, actions);
+#else
+    return get_useful_actions_bb(b, actions);
+#endif
+}
+
+
+int get_useful_moves(const Board *b, Move moves[LEN_ACTIONS]) {
+    // get_useful_actionsと同じ指手をMove型で列挙する.
+#if MOVE_GENERATOR == SCAN_GENERATOR
+    Action actions[LEN_ACTIONS];
+    int len_actions = get_useful_actions_by_scan(b, actions);
+    for (int i = 0; i < len_actions; i++)
+        moves[i] = action_to_move(actions[i]);
+    return len_actions;
+#else
+    return get_useful_moves_bb(b, moves);
+#endif
+}
+
+
 void piece_moves_to_vector(const Board *b, double vec[], int start_index) {
     /*
     各マスについて, ききのある駒の数を数える.
     評価関数の入力に用いる.
+    ききはビットボードの表 (attacks_from) から求める.
     */
 
     // 0.0で初期化する.
@@ -528,36 +547,18 @@ void piece_moves_to_vector(const Board *b, double vec[], int start_index) {
         vec[start_index + i] = 0.0;
 
     // 数える.
-    for (int i = 0; i < 5; i++) {
-        for (int j = 0; j < 5; j++) {
-            int piece = b->board[i][j];
-            if (piece <= 0)
-                // 自分の駒がないとき
-                continue;
-            if (piece != KAKU && piece != HISHA) {
-                // 駒が角や飛ではないときに, 周囲に動く手を列挙する.
-                for (int k = 0; k < move_length[piece]; k++) {
-                    int x = i + move_matrix_x[piece][k];
-                    int y = j + move_matrix_y[piece][k];
-                    if (0 <= x && x < 5 && 0 <= y && y < 5) {// && b->board[x][y] <= EMPTY) {
-                        vec[start_index + 25*(piece%NARI) + 5*x + y] += 1.0;
-                    }
-                }
-            }
-            if (piece % NARI == KAKU || piece % NARI == HISHA) {
-                // 角, 馬, 飛, 龍が直線的に動く手を列挙する.
-                for (int k = 0; k < move_length[piece % NARI]; k++) {
-                    int x = i + move_matrix_x[piece % NARI][k];
-                    int y = j + move_matrix_y[piece % NARI][k];
-                    while (0 <= x && x < 5 && 0 <= y && y < 5) {// && b->board[x][y] <= EMPTY) {
-                        vec[start_index + 25*(piece%NARI) + 5*x + y] += 1.0;
-                        if (b->board[x][y] != EMPTY)
-                            // 他の駒とぶつかったとき
-                            break;
-                        x += move_matrix_x[piece % NARI][k];
-                        y += move_matrix_y[piece % NARI][k];
-                    }
-                }
+    BitBoard bb = to_bitboard(b);
+    SquareSet occupied = bb.occupied[0] | bb.occupied[1];
+    for (int piece = FU; piece <= MAX_PIECE_NUMBER; piece++) {
+        SquareSet from_set = bb.pieces[0][piece];
+        while (from_set) {
+            int from = __builtin_ctz(from_set);
+            from_set &= from_set - 1;
+            SquareSet attacks = attacks_from(0, piece, from, occupied);
+            while (attacks) {
+                int to = __builtin_ctz(attacks);
+                attacks &= attacks - 1;
+                vec[start_index + 25*(piece%NARI) + to] += 1.0;
             }
         }
     }
@@ -3,6 +3,7 @@
 
 
 #include <stdbool.h>
+#include <stdint.h>
 #include "gamedef.h"
 #include "Action.h"
 
@@ -11,10 +12,10 @@
  * Boardクラスの定義
  *********************************/
 
-typedef struct {            // 盤面を(持ち駒とセットで)入れておく構造体
-    int board[5][5];        // 盤面
-    int next_stock[6];      // 手番側の持ち駒
-    int previous_stock[6];  // 手番ではない方の持ち駒
+typedef struct {                // 盤面を(持ち駒とセットで)入れておく構造体 (1マス1バイト, パディングなしの37バイト)
+    int8_t board[5][5];         // 盤面
+    uint8_t next_stock[6];      // 手番側の持ち駒
+    uint8_t previous_stock[6];  // 手番ではない方の持ち駒
 } Board;
 
 
@@ -44,10 +45,18 @@ bool is_drop_pawn_check(const Board *b, Action action);
 
 bool is_useful(const Board *b, const Action *action);
 
+int get_all_actions_by_scan(const Board *b, Action all_actions[LEN_ACTIONS]);
+
 int get_all_actions(const Board *b, Action all_actions[LEN_ACTIONS]);
 
+int get_all_moves(const Board *b, Move all_moves[LEN_ACTIONS]);
+
+int get_useful_actions_by_scan(const Board *b, Action actions[LEN_ACTIONS]);
+
 int get_useful_actions(const Board *b, Action actions[LEN_ACTIONS]);
 
+int get_useful_moves(const Board *b, Move moves[LEN_ACTIONS]);
+
 void count_connections(const Board *b, double counts[5][5]);
 
 void piece_moves_to_vector(const Board *b, double vec[], int start_index);
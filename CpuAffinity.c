@@ -0,0 +1,55 @@
+// sched_getaffinityとpthread_setaffinity_npを使うために必要 (Game.hのcloneと衝突するので, このファイルではGame.hを読み込まない)
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <unistd.h>
+#include "CpuAffinity.h"
+
+
+/*
+プロセスが起動したときに使えたCPU (affinityマスクに含まれるCPU) の一覧を最初の呼び出しで記録しておく.
+コンテナでCPUが制限されている場合もマスクに反映されるので, マシン全体のCPUの数より正確である.
+スレッドを固定した後もマスクは変わるが, 一覧は最初に記録したものを使い続ける.
+*/
+
+static pthread_once_t cpus_once_ = PTHREAD_ONCE_INIT;
+static int cpus_[CPU_SETSIZE];    // 使えるCPUの番号
+static int number_of_cpus_ = 0;   // cpus_の要素数
+
+
+static void detect_cpus_(void) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set))
+                cpus_[number_of_cpus_++] = cpu;
+    }
+
+    // マスクが取れなければ, オンラインのCPUが全て使えるものとする
+    if (number_of_cpus_ == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < online && cpu < CPU_SETSIZE; ++cpu)
+            cpus_[number_of_cpus_++] = cpu;
+    }
+    if (number_of_cpus_ == 0)
+        cpus_[number_of_cpus_++] = 0;
+}
+
+
+int get_number_of_available_cpus(void) {
+    // このプロセスが使えるCPUの数 (1以上)
+    pthread_once(&cpus_once_, detect_cpus_);
+    return number_of_cpus_;
+}
+
+
+bool pin_thread_to_cpu(pthread_t thread, int cpu_index) {
+    // threadを, 使えるCPUのうちcpu_index番目 (CPUの数で割った余り) のものだけで動かす. 失敗したら偽を返す
+    const int number_of_cpus = get_number_of_available_cpus();
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus_[cpu_index % number_of_cpus], &set);
+    return pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set) == 0;
+}
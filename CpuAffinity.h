@@ -0,0 +1,18 @@
+#ifndef CPUAFFINITY_H
+#define CPUAFFINITY_H
+
+
+#include <stdbool.h>
+#include <pthread.h>
+
+
+/*********************************
+ * CPUの検出とスレッドの固定を行う関数
+ *********************************/
+
+int get_number_of_available_cpus(void);
+
+bool pin_thread_to_cpu(pthread_t thread, int cpu_index);
+
+
+#endif  /* CPUAFFINITY_H */
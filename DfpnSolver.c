@@ -0,0 +1,289 @@
+#include "DfpnSolver.h"
+
+
+/*
+df-pn (depth-first proof-number search) で, 攻め方の勝ちを証明 (または反証) する.
+攻め方の手番の局面をORノード, 玉方の手番の局面をANDノードとし, 指手はget_perfectly_useful_moves_with_tfrで生成する.
+詰みに限らず, 指手生成が勝ちの一手を返す局面 (1手で勝てる局面) を末端とする.
+
+証明数・反証数は置換表にだけ記録し, ゲーム木はメモリに持たない. 置換表は複数のスレッドで共有でき,
+各スレッドは子局面の値を読み直しながら探索する. 探索中のスレッドが多い子局面は選ばれにくくする.
+
+千日手と手数の上限の扱い:
+  - 探索中の手順に同じ局面が現れた場合, ゲームの手数の上限を超えた場合, 千日手が起こりうる局面
+    (has_repetition_candidates) に来た場合は, 攻め方の勝ちではない (反証数0) とみなす.
+  - これらは手順に依存するので, これらに基づく反証は置換表に記録しない.
+  - 証明はこれらの局面を含まないが, 手数の上限までに証明木の末端に届くことを前提にしている.
+    そこで証明は証明木の手数とともに記録し, 置換表を引いた局面の手数にその手数を足して上限を超える証明は使わない.
+*/
+
+
+typedef struct {           // ノードの証明数・反証数
+    uint32_t pn;           // 証明数
+    uint32_t dn;           // 反証数
+    Move move;             // 最善の指手
+    int proof_length;      // 証明済み (pn == 0) のとき, 証明木の最も深い末端までの手数
+    bool depends_on_path;  // 反証が手順に依存する (置換表に記録できない) か否か
+} DfpnValue;
+
+typedef struct {                   // df-pnの途中の状態を表す構造体
+    DfpnTable *table;              // 証明数・反証数を記録する置換表
+    Game *game;                    // 探索中の局面
+    DfpnConfig config;             // 探索の設定
+    int attacker_parity;           // 攻め方の手番のときの game->turn % 2
+    long long nodes;               // 探索したノード数
+    bool stopped;                  // 探索を打ち切ったか否か
+    int ply;                       // pathの要素数
+    uint64_t path[DFPN_MAX_PLY];   // 根から現在の局面の親までの局面のゾブリストハッシュ値
+} DfpnSearch;
+
+
+static inline bool is_or_node_(const DfpnSearch *search) {
+    return search->game->turn % 2 == search->attacker_parity;
+}
+
+
+static inline uint32_t add_(uint32_t a, uint32_t b) {
+    // 無限大を超えないように足す (無限大でない値の和は無限大 - 1で止める)
+    if (a >= DFPN_INFINITY || b >= DFPN_INFINITY)
+        return DFPN_INFINITY;
+    return (a + b >= DFPN_INFINITY) ? DFPN_INFINITY - 1 : a + b;
+}
+
+
+static inline uint32_t widen_(uint32_t second) {
+    // 2番目に良い子の値から子の閾値を決める (1 + ε トリックで, 同じ子を続けて探索しやすくする)
+    uint32_t threshold = second + second / 4 + 1;
+    return (threshold >= DFPN_INFINITY) ? DFPN_INFINITY - 1 : threshold;
+}
+
+
+static bool is_on_path_(const DfpnSearch *search, uint64_t key) {
+    for (int i = 0; i < search->ply; i++)
+        if (search->path[i] == key)
+            return true;
+    return false;
+}
+
+
+static bool probe_(const DfpnSearch *search, uint64_t key, int turn, DfpnValue *value) {
+    // 手数turnの局面keyの記録を置換表から引く. 証明はturnから手数の上限までに収まる場合だけ使い,
+    // 収まらなければ記録がないものとして扱う
+    uint32_t pn, dn;
+    Move move;
+    int proof_length;
+    if (!dfpn_probe(search->table, key, &pn, &dn, &move, &proof_length))
+        return false;
+    if (pn == 0 && turn + proof_length > search->game->max_turn)
+        return false;
+
+    *value = (DfpnValue) {.pn=pn, .dn=dn, .move=move, .proof_length=proof_length, .depends_on_path=false};
+    return true;
+}
+
+
+static bool is_stopped_(DfpnSearch *search) {
+    if (!search->stopped && search->config.should_stop != NULL)
+        search->stopped = search->config.should_stop(search->config.stop_arg);
+    return search->stopped;
+}
+
+
+static DfpnValue terminal_value_(const DfpnSearch *search, bool side_to_move_wins, Move move) {
+    // 勝敗が決まっている局面の値
+    if (side_to_move_wins == is_or_node_(search))
+        return (DfpnValue) {.pn=0, .dn=DFPN_INFINITY, .move=move, .proof_length=0, .depends_on_path=false};
+    else
+        return (DfpnValue) {.pn=DFPN_INFINITY, .dn=0, .move=move, .proof_length=0, .depends_on_path=false};
+}
+
+
+static DfpnValue evaluate_(DfpnSearch *search, uint64_t key) {
+    /*
+    探索中の局面の子 (do_move済み) の証明数・反証数の初期値を求める.
+    置換表に記録がなければ, 1手で勝てるかを調べ, 勝てなければ手番側の指手の数を初期値とする (df-pn+).
+    */
+    Game *game = search->game;
+    if (search->ply + 1 >= DFPN_MAX_PLY || game->turn > game->max_turn ||
+        is_on_path_(search, key) || has_repetition_candidates(game))
+        return (DfpnValue) {.pn=DFPN_INFINITY, .dn=0, .move=NULL_MOVE, .proof_length=0, .depends_on_path=true};
+
+    DfpnValue value = {.proof_length=0, .depends_on_path=false};
+    if (probe_(search, key, game->turn, &value))
+        return value;
+
+    Move moves[LEN_ACTIONS];
+    const int len_moves = get_perfectly_useful_moves_with_tfr(game, moves);
+    if (len_moves <= 0) {
+        // 手番側がすぐに勝つ (-1), または指せる手がなく負ける (0) 局面
+        value = terminal_value_(search, len_moves == -1, (len_moves == -1) ? moves[0] : NULL_MOVE);
+        dfpn_store(search->table, key, value.pn, value.dn, value.move, value.proof_length);
+        return value;
+    }
+
+    value.pn = (is_or_node_(search)) ? 1 : (uint32_t) len_moves;
+    value.dn = (is_or_node_(search)) ? (uint32_t) len_moves : 1;
+    value.move = NULL_MOVE;
+    return value;
+}
+
+
+static DfpnValue mid_(DfpnSearch *search, uint64_t key, uint32_t threshold_pn, uint32_t threshold_dn) {
+    /*
+    現在の局面keyを, 証明数がthreshold_pn以上か反証数がthreshold_dn以上になるまで (または打ち切られるまで) 探索し,
+    その時点の証明数・反証数を返す. 返す前に置換表に記録する.
+    */
+    Game *game = search->game;
+    const bool is_or_node = is_or_node_(search);
+    ++search->nodes;
+
+    // 他のスレッドが既に閾値を超えるまで探索していれば, その値を使う
+    DfpnValue value = {.proof_length=0, .depends_on_path=false};
+    if (probe_(search, key, game->turn, &value) && (value.pn >= threshold_pn || value.dn >= threshold_dn))
+        return value;
+
+    Move moves[LEN_ACTIONS];
+    const int len_moves = get_perfectly_useful_moves_with_tfr(game, moves);
+    if (len_moves <= 0) {
+        value = terminal_value_(search, len_moves == -1, (len_moves == -1) ? moves[0] : NULL_MOVE);
+        dfpn_store(search->table, key, value.pn, value.dn, value.move, value.proof_length);
+        return value;
+    }
+
+    uint64_t keys[LEN_ACTIONS];
+    uint32_t pns[LEN_ACTIONS], dns[LEN_ACTIONS];
+    int proof_lengths[LEN_ACTIONS];
+    bool depends_on_path[LEN_ACTIONS];
+    for (int i = 0; i < len_moves; i++) {
+        do_move(game, moves[i]);
+        keys[i] = get_zobrist_key(game);
+        DfpnValue child = evaluate_(search, keys[i]);
+        undo_action(game);
+        pns[i] = child.pn;
+        dns[i] = child.dn;
+        proof_lengths[i] = child.proof_length;
+        depends_on_path[i] = child.depends_on_path;
+    }
+
+    search->path[search->ply++] = key;
+    const int offset = search->config.thread_index % len_moves;  // 同点の子をスレッドごとに違う順で選ぶ
+
+    for (;;) {
+        // 他のスレッドが進めた子の値を取り込む
+        for (int i = 0; i < len_moves; i++) {
+            DfpnValue child;
+            if (!depends_on_path[i] && probe_(search, keys[i], game->turn + 1, &child)) {
+                pns[i] = child.pn;
+                dns[i] = child.dn;
+                proof_lengths[i] = child.proof_length;
+            }
+        }
+
+        // ORノードは 証明数 = 子の証明数の最小値, 反証数 = 子の反証数の和 (ANDノードはその逆)
+        const uint32_t *min_side = (is_or_node) ? pns : dns;
+        const uint32_t *sum_side = (is_or_node) ? dns : pns;
+        uint32_t min_value = DFPN_INFINITY, sum_value = 0;
+        int best = 0, max_proof_length = 0;
+        bool has_independent_zero = false, has_dependent_child = false;
+        for (int i = 0; i < len_moves; i++) {
+            // ORノードで証明済みの子が複数あれば, 証明の手数が最も短い子を選ぶ
+            if (min_side[i] < min_value ||
+                (is_or_node && pns[i] == 0 && min_value == 0 && proof_lengths[i] < proof_lengths[best])) {
+                min_value = min_side[i];
+                best = i;
+            }
+            if (pns[i] == 0 && proof_lengths[i] > max_proof_length)
+                max_proof_length = proof_lengths[i];
+            sum_value = add_(sum_value, sum_side[i]);
+            has_independent_zero |= dns[i] == 0 && !depends_on_path[i];
+            has_dependent_child |= depends_on_path[i];
+        }
+        value.pn = (is_or_node) ? min_value : sum_value;
+        value.dn = (is_or_node) ? sum_value : min_value;
+        value.move = moves[best];
+        // 証明の手数は, ORノードでは選んだ子の, ANDノードでは全ての子の証明の手数の最大値に1を足したもの
+        value.proof_length = (is_or_node) ? proof_lengths[best] + 1 : max_proof_length + 1;
+        if (value.proof_length > DFPN_MAX_PROOF_LENGTH)
+            value.proof_length = DFPN_MAX_PROOF_LENGTH;
+        // 反証が手順に依存するのは, ORノードでは手順に依存する子があるとき, ANDノードでは依存しない反証済みの子がないとき
+        value.depends_on_path = value.dn == 0 && ((is_or_node) ? has_dependent_child : !has_independent_zero);
+
+        if (value.pn >= threshold_pn || value.dn >= threshold_dn || is_stopped_(search))
+            break;
+
+        // 閾値を超えていない子のうち, 探索中のスレッドの数で水増しした値が最も小さい子を選ぶ
+        const uint32_t child_threshold = (is_or_node) ? threshold_pn : threshold_dn;
+        int selected = best;
+        uint32_t first = DFPN_INFINITY, second = DFPN_INFINITY;
+        for (int k = 0; k < len_moves; k++) {
+            const int i = (k + offset) % len_moves;
+            if (min_side[i] >= child_threshold)
+                continue;
+            uint32_t inflated = min_side[i] + dfpn_visitors(search->table, keys[i]) * (1 + min_side[i] / 4);
+            if (inflated < first) {
+                second = first;
+                first = inflated;
+                selected = i;
+            } else if (inflated < second) {
+                second = inflated;
+            }
+        }
+
+        uint32_t child_threshold_pn, child_threshold_dn;
+        if (is_or_node) {
+            child_threshold_pn = (threshold_pn < widen_(second)) ? threshold_pn : widen_(second);
+            child_threshold_dn = threshold_dn - value.dn + dns[selected];
+        } else {
+            child_threshold_pn = threshold_pn - value.pn + pns[selected];
+            child_threshold_dn = (threshold_dn < widen_(second)) ? threshold_dn : widen_(second);
+        }
+
+        do_move(game, moves[selected]);
+        dfpn_enter(search->table, keys[selected]);
+        DfpnValue child = mid_(search, keys[selected], child_threshold_pn, child_threshold_dn);
+        dfpn_leave(search->table, keys[selected]);
+        undo_action(game);
+
+        pns[selected] = child.pn;
+        dns[selected] = child.dn;
+        proof_lengths[selected] = child.proof_length;
+        depends_on_path[selected] = child.depends_on_path;
+    }
+
+    --search->ply;
+    if (!value.depends_on_path)
+        dfpn_store(search->table, key, value.pn, value.dn, value.move, value.proof_length);
+    return value;
+}
+
+
+DfpnResult solve_dfpn(DfpnTable *table, Game *game, DfpnConfig config) {
+    /*
+    gameの現在の局面で, 攻め方の勝ちが証明 (pn == 0) か反証 (dn == 0) されるまで, またはconfig.should_stopが
+    真を返すまで探索する. 置換表tableに前回までの探索の結果があれば引き継ぐ.
+    gameは探索中に動かすが, 返るときには元の局面に戻っている. 結果の指手はgameのdo_moveに渡せる向きである.
+    */
+    DfpnSearch search = {
+            .table=table,
+            .game=game,
+            .config=config,
+            .attacker_parity=(config.attacker_is_first) ? 1 : 0,
+            .nodes=0,
+            .stopped=false,
+            .ply=0
+    };
+
+    DfpnValue value;
+    if (game->turn > game->max_turn || has_repetition_candidates(game))
+        value = (DfpnValue) {.pn=DFPN_INFINITY, .dn=0, .move=NULL_MOVE, .proof_length=0, .depends_on_path=true};
+    else
+        value = mid_(&search, get_zobrist_key(game), DFPN_INFINITY - 1, DFPN_INFINITY - 1);
+
+    return (DfpnResult) {
+            .pn=value.pn,
+            .dn=value.dn,
+            .move=value.move,
+            .nodes=search.nodes,
+            .stopped=search.stopped
+    };
+}
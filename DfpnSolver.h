@@ -0,0 +1,40 @@
+#ifndef DFPNSOLVER_H
+#define DFPNSOLVER_H
+
+
+#include "gamedef.h"
+#include "Action.h"
+#include "Game.h"
+#include "DfpnTable.h"
+
+#define DFPN_MAX_PLY 256  // df-pnで読む手数の最大値 (ゲームの手数の上限で先に打ち切られる)
+
+
+/*********************************
+ * DfpnSolverクラスの定義
+ *********************************/
+
+typedef struct {                    // df-pnの探索の設定
+    bool attacker_is_first;         // 攻め方 (勝ちを証明したい側) が先手か否か
+    int thread_index;               // 同じ置換表を使うスレッドの中での番号 (同点の指手の選び方をスレッドごとに変える)
+    bool (*should_stop)(void *arg); // 真を返したら探索を打ち切る関数 (NULLなら打ち切らない)
+    void *stop_arg;                 // should_stopに渡す引数
+} DfpnConfig;
+
+typedef struct {          // df-pnの探索の結果を表す構造体
+    uint32_t pn;          // 根の証明数 (0なら攻め方の勝ち)
+    uint32_t dn;          // 根の反証数 (0なら攻め方の勝ちはない, またはこの探索では示せない)
+    Move move;            // 根の最善の指手 (攻め方の勝ちのときはその指手, 手番側から見た向き)
+    long long nodes;      // 探索したノード数
+    bool stopped;         // should_stopによって打ち切られたか否か
+} DfpnResult;
+
+
+/*********************************
+ * DfpnSolverクラスのメソッド
+ *********************************/
+
+DfpnResult solve_dfpn(DfpnTable *table, Game *game, DfpnConfig config);
+
+
+#endif  /* DFPNSOLVER_H */
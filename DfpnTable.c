@@ -0,0 +1,159 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "DfpnTable.h"
+
+
+/*
+TranspositionTableと同じく, エントリは check = key ^ data と data の2つの64bitの値からなり,
+それぞれを独立にアトミックに読み書きする. 書き込みが混ざったエントリは check ^ data がkeyと一致しないので,
+単に記録がないものとして扱われる. そのため読み書きのどちらにもロックやCASは必要ない.
+
+dataのビット配置: 0-15bit 最善の指手, 16-35bit 証明数, 36-55bit 反証数, 56-63bit 証明の手数
+(証明数と反証数が両方0になることはないので, dataが0のエントリは空きとみなせる)
+証明の手数は, 証明済み (証明数0) の局面から証明木の最も深い末端までの手数である. ゲームの手数の上限までに
+残っている手数がこれより少なければ, その証明は使えない (判定は置換表を引く側で行う).
+
+visitorsはエントリとは別の, 局面を探索中のスレッドの数を数える小さな配列である.
+ハッシュ値の下位ビットだけで引くので別の局面と数を共有することがあるが, 指手を選ぶときの目安にしか使わない.
+*/
+
+#define DATA_MOVE_(data)  ((Move) ((data) & 0xFFFF))
+#define DATA_PN_(data)    ((uint32_t) (((data) >> 16) & 0xFFFFF))
+#define DATA_DN_(data)    ((uint32_t) (((data) >> 36) & 0xFFFFF))
+#define DATA_LENGTH_(data) ((int) ((data) >> 56))
+
+#define VISITORS_BITS_OFFSET_ 2  // visitorsの要素数はエントリの数の 1/2^VISITORS_BITS_OFFSET_
+
+
+static inline uint64_t pack_data_(uint32_t pn, uint32_t dn, Move move, int proof_length) {
+    if (pn > DFPN_INFINITY)
+        pn = DFPN_INFINITY;
+    if (dn > DFPN_INFINITY)
+        dn = DFPN_INFINITY;
+    assert(0 <= proof_length && proof_length <= DFPN_MAX_PROOF_LENGTH);
+    return (uint64_t) move | (uint64_t) pn << 16 | (uint64_t) dn << 36 | (uint64_t) proof_length << 56;
+}
+
+
+static inline bool is_proven_(uint64_t data) {
+    // 証明か反証が済んだ (これ以上値が変わらない) エントリか否か
+    return DATA_PN_(data) == 0 || DATA_DN_(data) == 0;
+}
+
+
+static inline DfpnBucket *bucket_of_(const DfpnTable *table, uint64_t key) {
+    return &table->buckets[key & table->mask];
+}
+
+
+DfpnTable construct_dfpn_table(int size_bits) {
+    // 2^size_bits個のエントリを持つ置換表を作る
+    assert(size_bits >= 2 + VISITORS_BITS_OFFSET_);
+
+    uint64_t number_of_buckets = ((uint64_t) 1 << size_bits) / DFPN_BUCKET_SIZE;
+    uint64_t number_of_visitors = (uint64_t) 1 << (size_bits - VISITORS_BITS_OFFSET_);
+    DfpnTable table = {
+            .buckets=(DfpnBucket *) aligned_alloc(sizeof(DfpnBucket), number_of_buckets * sizeof(DfpnBucket)),
+            .mask=number_of_buckets - 1,
+            .visitors=(atomic_uchar *) malloc(number_of_visitors * sizeof(atomic_uchar)),
+            .visitors_mask=number_of_visitors - 1
+    };
+    assert(table.buckets != NULL);
+    assert(table.visitors != NULL);
+    clear_dfpn_table(&table);
+
+    return table;
+}
+
+
+void destruct_dfpn_table(DfpnTable *table) {
+    free(table->buckets);
+    free(table->visitors);
+    table->buckets = NULL;
+    table->visitors = NULL;
+}
+
+
+void clear_dfpn_table(DfpnTable *table) {
+    // 全てのエントリを空にする (他のスレッドが読み書きしていないときに呼ぶこと)
+    memset(table->buckets, 0, (table->mask + 1) * sizeof(DfpnBucket));
+    memset(table->visitors, 0, (table->visitors_mask + 1) * sizeof(atomic_uchar));
+}
+
+
+bool dfpn_probe(const DfpnTable *table, uint64_t key, uint32_t *pn, uint32_t *dn, Move *move, int *proof_length) {
+    // 局面keyの記録を探し, あれば証明数, 反証数, 最善の指手, 証明の手数 (証明済みでなければ0) を代入して真を返す
+    DfpnBucket *bucket = bucket_of_(table, key);
+    for (int i = 0; i < DFPN_BUCKET_SIZE; i++) {
+        uint64_t data = atomic_load_explicit(&bucket->entries[i].data, memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&bucket->entries[i].check, memory_order_relaxed);
+        if (data != 0 && (check ^ data) == key) {
+            *pn = DATA_PN_(data);
+            *dn = DATA_DN_(data);
+            *move = DATA_MOVE_(data);
+            *proof_length = DATA_LENGTH_(data);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void dfpn_store(DfpnTable *table, uint64_t key, uint32_t pn, uint32_t dn, Move move, int proof_length) {
+    /*
+    局面keyの証明数と反証数 (証明済みならその手数proof_lengthも) を記録する. 同じ局面の記録か空きのエントリがあればそこに書き込み,
+    なければバケットの中で最も安く求め直せる (証明数 + 反証数が最小の) 未証明のエントリを置き換える
+    (全て証明・反証済みなら先頭を置き換える).
+    証明・反証済みの記録は, 同じ局面の未証明の値では上書きしない. 同じ局面の証明は, より短い証明でだけ上書きする.
+    */
+    assert(pn != 0 || dn != 0);
+
+    const uint64_t data = pack_data_(pn, dn, move, (pn == 0) ? proof_length : 0);
+    DfpnBucket *bucket = bucket_of_(table, key);
+    int replace_index = 0;
+    uint64_t min_cost = UINT64_MAX;
+    for (int i = 0; i < DFPN_BUCKET_SIZE; i++) {
+        uint64_t old_data = atomic_load_explicit(&bucket->entries[i].data, memory_order_relaxed);
+        uint64_t old_check = atomic_load_explicit(&bucket->entries[i].check, memory_order_relaxed);
+        if (old_data == 0) {
+            replace_index = i;
+            break;
+        }
+        if ((old_check ^ old_data) == key) {
+            if (is_proven_(old_data) && !is_proven_(data))
+                return;
+            if (DATA_PN_(old_data) == 0 && pn == 0 && DATA_LENGTH_(old_data) <= proof_length)
+                return;
+            replace_index = i;
+            break;
+        }
+
+        uint64_t cost = (is_proven_(old_data)) ? UINT64_MAX - 1 : (uint64_t) DATA_PN_(old_data) + DATA_DN_(old_data);
+        if (cost < min_cost) {
+            min_cost = cost;
+            replace_index = i;
+        }
+    }
+
+    atomic_store_explicit(&bucket->entries[replace_index].check, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&bucket->entries[replace_index].data, data, memory_order_relaxed);
+}
+
+
+void dfpn_enter(DfpnTable *table, uint64_t key) {
+    // 局面keyの探索を始めたことを記録する
+    atomic_fetch_add_explicit(&table->visitors[key & table->visitors_mask], 1, memory_order_relaxed);
+}
+
+
+void dfpn_leave(DfpnTable *table, uint64_t key) {
+    // 局面keyの探索を終えたことを記録する (dfpn_enterと対にして呼ぶ)
+    atomic_fetch_sub_explicit(&table->visitors[key & table->visitors_mask], 1, memory_order_relaxed);
+}
+
+
+int dfpn_visitors(const DfpnTable *table, uint64_t key) {
+    // 局面keyを探索中のスレッドの数の目安
+    return atomic_load_explicit(&table->visitors[key & table->visitors_mask], memory_order_relaxed);
+}
@@ -0,0 +1,57 @@
+#ifndef DFPNTABLE_H
+#define DFPNTABLE_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "Action.h"
+
+#define DFPN_BUCKET_SIZE  4                     // 1つのバケットに入るエントリの数 (1バケット = 64byte = キャッシュライン1本)
+#define DFPN_INFINITY     ((1u << 20) - 1)      // 証明数・反証数の無限大 (エントリには20bitで記録する)
+#define DFPN_MAX_PROOF_LENGTH 255               // 記録できる証明の手数の最大値 (エントリには8bitで記録する)
+
+
+/*********************************
+ * DfpnTableクラスの定義
+ *********************************/
+
+typedef struct {                   // 置換表のエントリ
+    _Atomic uint64_t check;        // 局面のゾブリストハッシュ値とdataの排他的論理和 (書き込みの途中で読まれたことを検出する)
+    _Atomic uint64_t data;         // 証明数, 反証数, 証明の手数, 最善の指手を詰めた値 (0のときは空き)
+} DfpnEntry;
+
+typedef struct {
+    DfpnEntry entries[DFPN_BUCKET_SIZE];
+} __attribute__((aligned(64))) DfpnBucket;
+
+typedef struct {                   // df-pnの証明数・反証数を複数のスレッドからロックなしで読み書きできる, 固定サイズの置換表
+    DfpnBucket *buckets;           // バケットの配列
+    uint64_t mask;                 // バケットの数 - 1 (バケットの数は2のべき乗)
+    atomic_uchar *visitors;        // 局面ごと (ハッシュ値の下位ビットごと) の, その局面を探索中のスレッドの数
+    uint64_t visitors_mask;        // visitorsの要素数 - 1
+} DfpnTable;
+
+
+/*********************************
+ * DfpnTableクラスのメソッド
+ *********************************/
+
+DfpnTable construct_dfpn_table(int size_bits);
+
+void destruct_dfpn_table(DfpnTable *table);
+
+void clear_dfpn_table(DfpnTable *table);
+
+bool dfpn_probe(const DfpnTable *table, uint64_t key, uint32_t *pn, uint32_t *dn, Move *move, int *proof_length);
+
+void dfpn_store(DfpnTable *table, uint64_t key, uint32_t pn, uint32_t dn, Move move, int proof_length);
+
+void dfpn_enter(DfpnTable *table, uint64_t key);
+
+void dfpn_leave(DfpnTable *table, uint64_t key);
+
+int dfpn_visitors(const DfpnTable *table, uint64_t key);
+
+
+#endif  /* DFPNTABLE_H */
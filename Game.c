@@ -2,32 +2,125 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "Game.h"
+#include "BitBoard.h"
+#include "generated_tables.h"
+
+#define CHECKING_UNKNOWN (-1)  // is_checking_historyの値がまだ計算されていないことを表す
+
+
+static inline int turn_color_(int turn) {
+    // ターンturnの手番側を, 先手なら0, 後手なら1で返す
+    return (turn % 2 == 1) ? 0 : 1;
+}
+
+
+static inline int absolute_square_(int color, int x, int y) {
+    // 手番側colorから見たマス(x, y)を, 先手から見た向きのマスの番号に直す
+    return (color == 0) ? 5 * x + y : 24 - (5 * x + y);
+}
+
+
+static inline Move orient_move_(const Game *game, Move move) {
+    // 手番側から見た指手と先手から見た指手を相互に変換する (後手の手番なら180°回転する)
+    return (turn_color_(game->turn) == 0) ? move : reverse_move(move);
+}
+
+
+static Board board_from_position_(const BitBoard *position, int color) {
+    // 先手から見た向きのビットボードpositionを, colorから見た向きのBoard型に変換する
+    BitBoard bb = *position;
+    if (color == 1)
+        reverse_bitboard(&bb);
+    return from_bitboard(&bb);
+}
+
+
+static RepetitionEntry *create_repetition_table_(int max_turn, int *mask) {
+    // 履歴の局面数の2倍以上の要素数を持つ, 空のハッシュ表を動的確保する
+    // 要素数 - 1 をmaskに代入する
+
+    int size = 1;
+    while (size < 2 * (max_turn + MALLOC_MARGIN))
+        size *= 2;
+    RepetitionEntry *table = (RepetitionEntry *) calloc(size, sizeof(RepetitionEntry));
+    assert(table != NULL);
+    *mask = size - 1;
+    return table;
+}
+
+
+static RepetitionEntry *find_repetition_entry_(const Game *game, uint64_t key) {
+    // 局面keyの要素を線形探査で探して返す, 表に無ければ挿入すべき空きの要素を返す
+
+    int index = (int) (key & game->repetition_mask);
+    while (game->repetition_table[index].count != 0 && game->repetition_table[index].key != key)
+        index = (index + 1) & game->repetition_mask;
+    return &game->repetition_table[index];
+}
+
+
+static void push_repetition_(Game *game, uint64_t key, int history_index) {
+    // 履歴のhistory_index番目に現れた局面keyを表に加える
+
+    RepetitionEntry *entry = find_repetition_entry_(game, key);
+    if (entry->count++ == 0) {
+        entry->key = key;
+        entry->first_index = history_index;
+    }
+    if (entry->count == 3)
+        ++game->repetition_candidates;
+}
+
+
+static void pop_repetition_(Game *game, uint64_t key) {
+    // 履歴の最後の局面keyを表から除く
+    // 履歴は後ろからしか除かれないので, 出現回数が0になる要素は最後に挿入された要素である
+    // したがって, その要素を空きにしても他の要素の線形探査の列は途切れない
+
+    RepetitionEntry *entry = find_repetition_entry_(game, key);
+    if (entry->count-- == 3)
+        --game->repetition_candidates;
+}
 
 
 Game create_game(int max_turn) {
     // Game型の変数を作るコンストラクタ
     // max_turnは保持する履歴の数
 
-    // history配列, is_checking_history配列の動的確保, 確保に失敗したらエラー
+    // history配列, is_checking_history配列, undo_history配列, key_history配列の動的確保, 確保に失敗したらエラー
     Hash *history = (Hash *) malloc((max_turn + MALLOC_MARGIN) * sizeof(Hash));
-    bool *is_checking_history = (bool *) malloc((max_turn + MALLOC_MARGIN) * sizeof(bool));
+    int8_t *is_checking_history = (int8_t *) malloc((max_turn + MALLOC_MARGIN) * sizeof(int8_t));
+    UndoRecord *undo_history = (UndoRecord *) malloc((max_turn + MALLOC_MARGIN) * sizeof(UndoRecord));
+    uint64_t *key_history = (uint64_t *) malloc((max_turn + MALLOC_MARGIN) * sizeof(uint64_t));
     assert(history != NULL);
     assert(is_checking_history != NULL);
+    assert(undo_history != NULL);
+    assert(key_history != NULL);
 
     // 初期盤面の生成
     Board b = create_board();
 
     // 履歴に初期盤面を追加
     history[0] = reverse_hash(encode(&b));
+    is_checking_history[0] = CHECKING_UNKNOWN;
+    key_history[0] = zobrist_key(&b, 1);
 
-    return (Game) {
+    Game game = {
             .current=b,
             .turn=1,
             .history=history,
             .history_len=1,
             .is_checking_history=is_checking_history,
+            .undo_history=undo_history,
+            .key_history=key_history,
+            .records_hash=true,
+            .position=to_bitboard(&b),
+            .fixed_orientation=false,
             .max_turn=max_turn
     };
+    game.repetition_table = create_repetition_table_(max_turn, &game.repetition_mask);
+    push_repetition_(&game, key_history[0], 0);
+    return game;
 }
 
 
@@ -37,6 +130,9 @@ void destruct_game(Game *game) {
 
     free(game->history);
     free(game->is_checking_history);
+    free(game->undo_history);
+    free(game->key_history);
+    free(game->repetition_table);
 }
 
 
@@ -51,48 +147,205 @@ Game clone(const Game *game, int max_turn) {
     Game game_copy = *game;
     game_copy.max_turn = max_turn;
 
-    // history配列, is_checking_history配列の動的確保, 確保に失敗したらエラー
+    // history配列, is_checking_history配列, undo_history配列, key_history配列の動的確保, 確保に失敗したらエラー
     Hash *history = (Hash *) malloc((max_turn + MALLOC_MARGIN) * sizeof(Hash));
-    bool *is_checking_history = (bool *) malloc((max_turn + MALLOC_MARGIN) * sizeof(bool));
+    int8_t *is_checking_history = (int8_t *) malloc((max_turn + MALLOC_MARGIN) * sizeof(int8_t));
+    UndoRecord *undo_history = (UndoRecord *) malloc((max_turn + MALLOC_MARGIN) * sizeof(UndoRecord));
+    uint64_t *key_history = (uint64_t *) malloc((max_turn + MALLOC_MARGIN) * sizeof(uint64_t));
     assert(history != NULL);
     assert(is_checking_history != NULL);
+    assert(undo_history != NULL);
+    assert(key_history != NULL);
 
-    // history配列, is_checking_history配列のコピー
+    // history配列, is_checking_history配列, undo_history配列, key_history配列のコピー
     for (int i = 0; i < game->history_len; ++i) {
         history[i] = game->history[i];
         is_checking_history[i] = game->is_checking_history[i];
+        undo_history[i] = game->undo_history[i];
+        key_history[i] = game->key_history[i];
     }
 
     game_copy.history = history;
     game_copy.is_checking_history = is_checking_history;
+    game_copy.undo_history = undo_history;
+    game_copy.key_history = key_history;
+
+    // max_turnに応じた大きさのハッシュ表を作り直す
+    game_copy.repetition_table = create_repetition_table_(max_turn, &game_copy.repetition_mask);
+    game_copy.repetition_candidates = 0;
+    for (int i = 0; i < game->history_len; ++i)
+        push_repetition_(&game_copy, key_history[i], i);
 
     return game_copy;
 }
 
 
-int is_threefold_repetition(const Game *game, Action action) {
-    // game->historyには手を打ち終わった直後まだ回転されていない盤面が入っているとする
-    // game->currentの盤面にactionを適用したとき、千日手が成立するか否かを判定して返す
-    // 通常の千日手の場合は1、連続王手の千日手の場合は-1を返し、千日手でない場合は0を返す
-    // 戻り値が-1となった場合は、historyが正常な棋譜であるならば自分の負けである
+void set_initial_board(Game *game, const Board *b) {
+    // 作成した直後のgameの初期盤面を, 先手の手番の盤面bに置き換える
+
+    assert(game->history_len == 1);
+    game->current = *b;
+    game->position = to_bitboard(b);
+    game->history[0] = reverse_hash(encode(b));
+    game->is_checking_history[0] = CHECKING_UNKNOWN;
+    pop_repetition_(game, game->key_history[0]);
+    game->key_history[0] = zobrist_key(b, game->turn);
+    push_repetition_(game, game->key_history[0], 0);
+}
+
+
+void set_hash_recording(Game *game, bool enabled) {
+    // historyにHashを記録するか否かを設定する
+    // 探索用のGameなどHashを参照しない場合は, 偽にするとdo_actionでのencodeが省略される
+    // 千日手の判定はkey_historyで行うので, 偽にしても影響はない
+
+    game->records_hash = enabled;
+}
 
-    int repetition_count = 0;  // 盤面の重複回数
-    int first_duplication_index = 0;
 
-    Board b = game->current;
-    update_board(&b, action);
-    Hash h = encode(&b);
+void set_fixed_orientation(Game *game, bool enabled) {
+    // 盤面を反転させない探索用のモードにするか否かを設定する
+    // 真にするとdo_actionでcurrentを更新しなくなり, 反転やBoard型の更新が省略される
+    // その間の手番側から見た盤面はget_current_boardで求める
+
+    if (game->fixed_orientation && !enabled)
+        game->current = get_current_board(game);
+    game->fixed_orientation = enabled;
+}
 
-    // 「次に打つプレイヤー」も含めて局面の一致を判定するため、自分の手番のみを見れば良い
-    // よって i -= 2 としている
-    for (int i = game->history_len - 2; i >= 0; i -= 2) {
-        if (hash_equal(h, game->history[i])) {
-            ++repetition_count;
-            first_duplication_index = i;
+
+Board get_current_board(const Game *game) {
+    // 手番側から見た現在の盤面を返す
+    // fixed_orientationが偽のときはcurrentと同じである
+
+    if (!game->fixed_orientation)
+        return game->current;
+    return board_from_position_(&game->position, turn_color_(game->turn));
+}
+
+
+uint64_t zobrist_key(const Board *b, int turn) {
+    /*
+    ターンturnの手番側から見た盤面bのゾブリストハッシュ値を計算する.
+    盤面を先手から見た向きに直し, 駒の持ち主・種類・マスごとの乱数と,
+    持ち駒の持ち主・種類・枚数ごとの乱数, 後手の手番であれば手番の乱数をXORする.
+    したがって, reverse_boardで向きを変えた盤面でも, 同じ局面・同じ手番であれば同じ値になる.
+    */
+    int color = turn_color_(turn);
+    uint64_t key = (color == 0) ? 0 : ZOBRIST_SIDE;
+
+    for (int x = 0; x < 5; x++) {
+        for (int y = 0; y < 5; y++) {
+            int piece = b->board[x][y];
+            if (piece > 0)
+                key ^= ZOBRIST_BOARD[color][piece][absolute_square_(color, x, y)];
+            else if (piece < 0)
+                key ^= ZOBRIST_BOARD[1 - color][-piece][absolute_square_(color, x, y)];
         }
     }
 
-    if (repetition_count >= 3) {  // 盤面bとの重複が3回以上あれば千日手
+    for (int piece = 0; piece < 6; piece++) {
+        for (int count = 1; count <= b->next_stock[piece]; count++)
+            key ^= ZOBRIST_STOCK[color][piece][count];
+        for (int count = 1; count <= b->previous_stock[piece]; count++)
+            key ^= ZOBRIST_STOCK[1 - color][piece][count];
+    }
+
+    return key;
+}
+
+
+uint64_t get_zobrist_key(const Game *game) {
+    // 現在の局面のゾブリストハッシュ値を返す
+
+    return game->key_history[game->history_len - 1];
+}
+
+
+bool has_repetition_candidates(const Game *game) {
+    // 履歴中に3回以上現れた局面があるか (次の数手で千日手が成立しうるか) を返す
+    // 偽のとき, 現在の局面の合法手は履歴によらず盤面だけで決まる
+
+    return game->repetition_candidates > 0;
+}
+
+
+static uint64_t zobrist_key_after_(const Game *game, Move move) {
+    // 先手から見た向きの指手moveを適用した後の局面のゾブリストハッシュ値を, 変化したマスと持ち駒だけから求める
+
+    const BitBoard *bb = &game->position;
+    int color = turn_color_(game->turn);
+    int to = move_to(move);
+    uint64_t key = get_zobrist_key(game) ^ ZOBRIST_SIDE;
+
+    if (move_drop(move)) {  // 持ち駒を打つ場合
+        key ^= ZOBRIST_BOARD[color][move_drop(move)][to];
+        key ^= ZOBRIST_STOCK[color][move_drop(move)][bb->stock[color][move_drop(move)]];
+    } else {  // 駒を動かす場合
+        int piece = piece_at(bb, color, move_from(move));
+        key ^= ZOBRIST_BOARD[color][piece][move_from(move)];
+
+        int gain = piece_at(bb, 1 - color, to);
+        if (gain != EMPTY) {
+            key ^= ZOBRIST_BOARD[1 - color][gain][to];
+            key ^= ZOBRIST_STOCK[color][gain % NARI][bb->stock[color][gain % NARI] + 1];
+        }
+
+        if (move_promotion(move) && piece < NARI)
+            piece += NARI;
+        key ^= ZOBRIST_BOARD[color][piece][to];
+    }
+
+    return key;
+}
+
+
+static bool is_checking_at_(const Game *game, int index) {
+    /*
+    履歴のindex番目の局面で, 直前に指した側が王手をかけているか否かを返す.
+    is_checking_historyは千日手が成立したときにしか参照されないので, do_actionでは計算しない.
+    未計算であれば, 現在の盤面からundo_historyをもとに1手ずつ戻しながら求めて記録する.
+    */
+    int8_t *is_checking_history = game->is_checking_history;
+    if (is_checking_history[index] != CHECKING_UNKNOWN)
+        return is_checking_history[index];
+
+    BitBoard bb = game->position;
+    for (int i = game->history_len - 1; i >= index; i--) {
+        // i番目の局面の手番はturn_color_(i + 1), その局面に至る1手を指した側はturn_color_(i)
+        if (is_checking_history[i] == CHECKING_UNKNOWN)
+            is_checking_history[i] = (int8_t) is_in_check(&bb, turn_color_(i + 1));
+        if (i > index) {
+            const UndoRecord *record = &game->undo_history[i];
+            undo_move_bb(&bb, turn_color_(i), record->move, record->moved_piece, record->captured_piece);
+        }
+    }
+    return is_checking_history[index];
+}
+
+
+static bool is_continuous_check_(const Game *game, int first_index) {
+    // 履歴のfirst_index番目から現在まで, 同じ側が指した直後の局面が全て王手であるかを判定する
+    // 千日手が成立したときにしか呼ばれないので, 線形に走査しても全体の計算量には影響しない
+
+    for (int i = first_index; i < game->history_len; i += 2) {
+        if (!is_checking_at_(game, i))
+            return false;
+    }
+    return true;
+}
+
+
+static int is_threefold_repetition_(const Game *game, Move move) {
+    // 現在の盤面に先手から見た向きの指手moveを適用したとき、千日手が成立するか否かを判定して返す
+    // 通常の千日手の場合は1、連続王手の千日手の場合は-1を返し、千日手でない場合は0を返す
+    // 戻り値が-1となった場合は、historyが正常な棋譜であるならば自分の負けである
+
+    // 局面の一致はゾブリストハッシュ値で判定し, 重複回数はrepetition_tableから引く
+    // ゾブリストハッシュ値は手番も含むので, 「次に打つプレイヤー」も含めて局面の一致を判定している
+    const RepetitionEntry *entry = find_repetition_entry_(game, zobrist_key_after_(game, move));
+
+    if (entry->count >= 3) {  // 盤面bとの重複が3回以上あれば千日手
         // 以下、連続王手の判定
         // 結論: 「自分が連続で相手に王手をかけていないか？」という事のみを判定すれば良い
         // ∵) 盤面bは自分が駒を動かした直後であるので、bは王手をかけられている状態ではない
@@ -101,69 +354,126 @@ int is_threefold_repetition(const Game *game, Action action) {
         //     今、このifブロックの中では自分の千日手が成立しているので、直近で相手は連続王手をしていない
         //     また、自分が打つ直前の状態が自分の王手状態になっている事もない (相手が王手放置の禁に抵触) //
 
-        int continuous_check = 1;
-        for (int i = first_duplication_index; i < game->history_len; i += 2) {
-            if (!game->is_checking_history[i]) {
-                continuous_check = 0;
-                break;
-            }
-        }
-
-        return (continuous_check) ? -1 : 1;
+        return is_continuous_check_(game, entry->first_index) ? -1 : 1;
     }
 
     return 0;
 }
 
 
+int is_threefold_repetition(const Game *game, Action action) {
+    // game->currentの盤面にactionを適用したとき、千日手が成立するか否かを判定して返す
+    // 戻り値はis_threefold_repetition_と同じ
+
+    return is_threefold_repetition_(game, orient_move_(game, action_to_move(action)));
+}
+
+
 int is_threefold_repetition_2(const Game *game) {
-    int repetition_count = 0;
-    int first_duplication_index = 0;
-
-    Hash h = game->history[game->history_len - 1];
-    for (int i = game->history_len - 3; i >= 0; i -= 2) {
-        if (hash_equal(h, game->history[i])) {
-            ++repetition_count;
-            first_duplication_index = i;
-        }
-    }
+    // 直前の1手で千日手が成立したか否かを判定して返す (戻り値はis_threefold_repetitionと同じ)
+    // 表の出現回数には直前の局面自身も含まれるので, 重複回数はそれより1少ない
 
-    if (repetition_count >= 3) {
-        int continuous_check = 1;
-        for (int i = first_duplication_index; i < game->history_len; i += 2) {
-            if (!game->is_checking_history[i]) {
-                continuous_check = 0;
-                break;
-            }
-        }
+    const RepetitionEntry *entry = find_repetition_entry_(game, get_zobrist_key(game));
 
-        return (continuous_check) ? -1 : 1;
-    }
+    if (entry->count - 1 >= 3)
+        return is_continuous_check_(game, entry->first_index) ? -1 : 1;
 
     return 0;
 }
 
 
+static void do_absolute_move_(Game *game, Move move) {
+    // 先手から見た向きの指手moveをエラーチェックをせずに実行する
+    // positionは反転させずに更新し, fixed_orientationが偽のときだけcurrentも更新する
+
+    int color = turn_color_(game->turn);
+    BitBoard *bb = &game->position;
+
+    // undo_actionで盤面を戻せるように, 動かす駒と取る駒を記録しておく
+    UndoRecord *record = &game->undo_history[game->history_len];
+    record->move = move;
+    if (move_drop(move)) {
+        record->moved_piece = (int8_t) move_drop(move);
+        record->captured_piece = EMPTY;
+    } else {
+        record->moved_piece = (int8_t) piece_at(bb, color, move_from(move));
+        record->captured_piece = (int8_t) piece_at(bb, 1 - color, move_to(move));
+    }
+
+    game->key_history[game->history_len] = zobrist_key_after_(game, move);
+    push_repetition_(game, game->key_history[game->history_len], game->history_len);
+    do_move_bb(bb, color, move);
+    game->is_checking_history[game->history_len] = CHECKING_UNKNOWN;
+
+    if (!game->fixed_orientation) {
+        // currentは手番側から見た向きで更新してから反転する
+        update_board(&game->current, move_to_action(orient_move_(game, move)));
+        if (game->records_hash)
+            game->history[game->history_len] = encode(&game->current);
+        reverse_board(&game->current);
+    } else if (game->records_hash) {
+        Board b = board_from_position_(bb, color);
+        game->history[game->history_len] = encode(&b);
+    }
+
+    ++game->history_len;
+    ++game->turn;
+}
+
+
 void do_action(Game *game, Action action) {
     // エラーチェックをせずにactionを実行する
     // デバッグしてない
 
-    update_board(&game->current, action);
-    game->is_checking_history[game->history_len] = is_checking(&game->current);
-    game->history[game->history_len] = encode(&game->current);
-    reverse_board(&game->current);
-    ++game->history_len;
-    ++game->turn;
+    do_absolute_move_(game, orient_move_(game, action_to_move(action)));
+}
+
+
+void do_move(Game *game, Move move) {
+    // Move型で表された指手を実行する (do_actionと同じ)
+
+    do_absolute_move_(game, orient_move_(game, move));
+}
+
+
+static void unmake_action_(Game *game) {
+    // undo_historyの記録をもとに, 直前の1手で変化したマスと持ち駒だけを元に戻す.
+
+    const UndoRecord *record = &game->undo_history[game->history_len - 1];
+    int color = turn_color_(game->turn - 1);  // 直前の1手を行った側
+    undo_move_bb(&game->position, color, record->move, record->moved_piece, record->captured_piece);
+
+    if (!game->fixed_orientation) {
+        Board *b = &game->current;
+        Move move = (color == 0) ? record->move : reverse_move(record->move);  // 行った側から見た指手
+        int to = move_to(move);
+
+        // 直前の1手を行った側から見た盤面に戻してから, 変化したマスを戻す
+        reverse_board(b);
+        if (move_drop(move)) {  // 持ち駒を打った場合
+            b->board[to / 5][to % 5] = EMPTY;
+            ++b->next_stock[record->moved_piece];
+        } else {  // 駒を動かした場合
+            int from = move_from(move);
+            b->board[from / 5][from % 5] = record->moved_piece;
+            b->board[to / 5][to % 5] = -record->captured_piece;
+            if (record->captured_piece != EMPTY)
+                --b->next_stock[record->captured_piece % NARI];
+        }
+    }
+
+    pop_repetition_(game, game->key_history[game->history_len - 1]);
+    --game->history_len;
+    --game->turn;
 }
 
 
 void undo_action(Game *game) {
     // ゲームを1ターン戻す
-    // デバッグしてない
 
     if (game->history_len < 2)
         return;
-    load(game, game->history_len - 1);
+    unmake_action_(game);
 }
 
 
@@ -184,117 +494,220 @@ void load(Game *game, int saved_id) {
         assert(false);
     }
 
-    Hash h = reverse_hash(game->history[saved_id - 1]);
-    game->current = decode(h);
-    game->history_len = saved_id;
-    game->turn = saved_id;
+    // 1手ずつ盤面を戻す (Hashからのデコードは行わない)
+    while (game->history_len > saved_id)
+        unmake_action_(game);
 }
 
 
-int get_all_actions_with_tfr(const Game *game, Action all_actions[LEN_ACTIONS]) {
-    // 選択可能な指手を全列挙する.
-    // get_all_actionsとは異なり, 千日手も考慮して, 反則手を完全に除くものとする.
+static bool has_reply_to_drop_pawn_check_(const Game *game) {
+    // 歩を打って王手された直後の局面で, 千日手も考慮して選択可能な指手が1つでもあるかを判定する.
+    // 王手されているので合法手は王手を回避する少数の指手だけであり,
+    // その中に持ち駒を打つ手は含まれない (打った歩は王に隣接している) ので, 打ち歩詰めの再帰的な判定は不要.
+    MovePicker picker;
+    init_move_picker_bb(&picker, &game->position, turn_color_(game->turn));
+    for (Move reply = next_move(&picker); reply != NULL_MOVE; reply = next_move(&picker)) {
+        int tfr = is_threefold_repetition_(game, reply);
+        if (!(tfr == -1 || (tfr == 1 && game->turn % 2)))
+            return true;
+    }
+    return false;
+}
+
+
+static bool is_legal_with_tfr_(const Game *game, Move move) {
+    // 千日手を考慮しなければ選択可能な先手から見た向きの指手moveが, 千日手を考慮しても選択可能かを判定する.
     // 手番を終えた側がすぐに負けになるような指手は反則手とみなす.
     // すなわち, 連続王手千日手や先手が千日手にもちこむ指手は反則手である.
     // 最後の審判のようなコーナーケースに注意する.
 
-    // 千日手を考慮せずに可能な指手を全列挙する.
-    Action tmp_actions[LEN_ACTIONS];
-    int len_tmp_actions = get_all_actions(&game->current, tmp_actions);
+    // 出現回数が3回以上の局面がなければ, moveでも相手の応手でも千日手は成立しない.
+    // 千日手を考慮しない合法手は, 打ち歩詰めも含めて既に除かれているので, そのまま選択可能である.
+    if (game->repetition_candidates == 0)
+        return true;
+
+    // 連続王手千日手と, 先手が千日手にもちこむ指手を削除する.
+    int tfr = is_threefold_repetition_(game, move);
+    if (tfr == -1 || (tfr == 1 && game->turn % 2))
+        return false;
+
+    // 最後の審判のようなケースを削除する.
+    // 先手に千日手を強いるような打ち歩詰めも削除する.
+    if (is_drop_pawn_check_bb(&game->position, turn_color_(game->turn), move)) {
+        do_absolute_move_((Game *) game, move);
+        bool has_reply = has_reply_to_drop_pawn_check_(game);
+        undo_action((Game *) game);
+        return has_reply;
+    }
+
+    return true;
+}
 
-    // 千日手関連の反則手を削除する.
+
+int get_all_moves_with_tfr(const Game *game, Move all_moves[LEN_ACTIONS]) {
+    // 選択可能な指手を全列挙する.
+    // get_all_actionsとは異なり, 千日手も考慮して, 反則手を完全に除くものとする.
+
+    // 千日手を考慮せずに可能な指手を, 先手から見た向きで全列挙する.
+    Move tmp_moves[LEN_ACTIONS];
+#if MOVE_GENERATOR == SCAN_GENERATOR
+    Board b = get_current_board(game);
+    int len_tmp_moves = get_all_moves(&b, tmp_moves);
+    for (int i = 0; i < len_tmp_moves; i++)
+        tmp_moves[i] = orient_move_(game, tmp_moves[i]);
+#else
+    int len_tmp_moves = generate_moves_bb(&game->position, turn_color_(game->turn), tmp_moves);
+#endif
+
+    // 千日手関連の反則手を削除し, 手番側から見た向きに戻す.
     int end_index = 0;
-    for (int i = 0; i < len_tmp_actions; i++) {
-        // 連続王手千日手と, 先手が千日手にもちこむ指手を削除する.
-        int tfr = is_threefold_repetition(game, tmp_actions[i]);
-        if (tfr == -1 || (tfr == 1 && game->turn % 2))
-            continue;
-        // 最後の審判のようなケースを削除する.
-        // 先手に千日手を強いるような打ち歩詰めも削除する.
-        if (is_drop_pawn_check(&game->current, tmp_actions[i])) {
-            do_action((Game *) game, tmp_actions[i]);
-
-            Action next_actions[LEN_ACTIONS];
-            if (get_all_actions_with_tfr(game, next_actions) == 0) {
-                // 打ち歩詰めのとき
-                undo_action((Game *) game);
-                continue;
-            } else {
-                undo_action((Game *) game);
-            }
-        }
-        all_actions[end_index++] = tmp_actions[i];
+    for (int i = 0; i < len_tmp_moves; i++) {
+        if (is_legal_with_tfr_(game, tmp_moves[i]))
+            all_moves[end_index++] = orient_move_(game, tmp_moves[i]);
     }
 
     return end_index;
 }
 
 
+static int moves_to_actions_(const Move moves[LEN_ACTIONS], int len_moves, Action actions[LEN_ACTIONS]) {
+    for (int i = 0; i < len_moves; i++)
+        actions[i] = move_to_action(moves[i]);
+    return len_moves;
+}
+
+
+int get_all_actions_with_tfr(const Game *game, Action all_actions[LEN_ACTIONS]) {
+    // get_all_moves_with_tfrのAction版
+    Move all_moves[LEN_ACTIONS];
+    return moves_to_actions_(all_moves, get_all_moves_with_tfr(game, all_moves), all_actions);
+}
+
+
 bool is_possible_action_with_tfr(const Game *game, Action action) {
     // 選択可能な指手かどうかを判定する.
     // is_possible_actionとは異なり, 千日手も考慮する.
-    Action all_actions[LEN_ACTIONS];
-    int len_all_actions = get_all_actions_with_tfr(game, all_actions);
-    for (int i = 0; i < len_all_actions; i++) {
-        if (action_equal(&action, &all_actions[i]))
+    Move move = action_to_move(action);
+    Move all_moves[LEN_ACTIONS];
+    int len_all_moves = get_all_moves_with_tfr(game, all_moves);
+    for (int i = 0; i < len_all_moves; i++) {
+        if (move == all_moves[i])
             return true;
     }
     return false;
 }
 
 
+int get_check_moves_with_tfr(const Game *game, Move moves[LEN_ACTIONS]) {
+    // 千日手も考慮して選択可能な指手のうち, 相手の王に王手をかける手だけを列挙する.
+    // 指手は手番側から見た向きで返す.
+
+    Move check_moves[LEN_ACTIONS];
+    int len_check_moves = get_check_moves_bb(&game->position, turn_color_(game->turn), check_moves);
+
+    int end_index = 0;
+    for (int i = 0; i < len_check_moves; i++) {
+        if (is_legal_with_tfr_(game, check_moves[i]))
+            moves[end_index++] = orient_move_(game, check_moves[i]);
+    }
+    return end_index;
+}
+
+
 bool is_checkmate_with_tfr(const Game *game) {
     // 詰みかどうかを判定する.
     // is_checkmateとは異なり, 千日手も考慮する.
     // 手番側に選択可能な指手があるときに0, ないときに1を返す.
-    Action all_actions[LEN_ACTIONS];
-    return get_all_actions_with_tfr(game, all_actions) == 0;
+    // 指手を段階的に生成し, 選択可能な指手が1つ見つかった時点で打ち切る.
+    if (game->repetition_candidates == 0)
+        // 千日手が成立しえないときは, 千日手を考慮しない合法手があるかだけを調べればよい.
+        return !has_legal_move_bb(&game->position, turn_color_(game->turn));
+
+    MovePicker picker;
+    init_move_picker_bb(&picker, &game->position, turn_color_(game->turn));
+    for (Move move = next_move(&picker); move != NULL_MOVE; move = next_move(&picker)) {
+        if (is_legal_with_tfr_(game, move))
+            return false;
+    }
+    return true;
 }
 
 
-int get_useful_actions_with_tfr(const Game *game, Action actions[LEN_ACTIONS]) {
+static bool is_mating_move_with_tfr_(const Game *game, Move move, bool counts_repetition) {
+    /*
+    千日手を考慮しても選択可能な先手から見た向きの指手moveを行うと, 相手が詰むかを判定する (1手詰めの判定).
+    counts_repetitionが真のときは, judgeと同じく後手が通常の千日手を決める指手も詰みとみなす.
+    出現回数が3回以上の局面がなければ千日手は成立しないので, 盤面を更新せずにききだけで調べる.
+    */
+    if (game->repetition_candidates == 0)
+        return is_mating_move_bb(&game->position, turn_color_(game->turn), move);
+
+    do_absolute_move_((Game *) game, move);
+    bool is_mate;
+    if (counts_repetition) {
+        int judge_result = judge(game);
+        assert(judge_result != 1);
+        is_mate = judge_result == -1;
+    } else {
+        is_mate = is_checkmate_with_tfr(game);
+    }
+    undo_action((Game *) game);
+    return is_mate;
+}
+
+
+int get_useful_moves_with_tfr(const Game *game, Move moves[LEN_ACTIONS]) {
     /*
     有用な指手を列挙する.
     相手の王を詰ませられるときは, その1手を代入する.
     そうでないときは, ごく一部の無駄な指手だけを除いて, ほぼ全ての指手を列挙する.
     */
 
-    // 選択可能な指手を全て列挙する.
-    Action all_actions[LEN_ACTIONS];
-    int len_all_actions = get_all_actions_with_tfr(game, all_actions);
-
+    // 駒を取る手, 王手をかける手, それ以外の手の順に選択可能な指手を列挙しながら,
     // 相手の王を詰ませられるかを判定する.
-    for (int i = 0; i < len_all_actions; i++) {
-        do_action((Game *) game, all_actions[i]);
-        if (is_checkmate_with_tfr(game)) {
-            // all_actions[i]を行うと相手の王が詰むとき
-            actions[0] = all_actions[i];
-            undo_action((Game *) game);
+    // 指手は先手から見た向きで扱い, 返すときに手番側から見た向きに戻す.
+    const int color = turn_color_(game->turn);
+    MovePicker picker;
+    init_move_picker_bb(&picker, &game->position, color);
+    Move all_moves[LEN_ACTIONS];
+    int len_all_moves = 0;
+    for (Move move = next_move(&picker); move != NULL_MOVE; move = next_move(&picker)) {
+        if (!is_legal_with_tfr_(game, move))
+            continue;
+        if (is_mating_move_with_tfr_(game, move, false)) {
+            // moveを行うと相手の王が詰むとき
+            moves[0] = orient_move_(game, move);
             return 1;
-        } else {
-            undo_action((Game *) game);
         }
+        all_moves[len_all_moves++] = move;
     }
 
     // ほぼ明らかに無駄な指手以外を列挙する.
     int end_index = 0;
-    for (int i = 0; i < len_all_actions; i++) {
-        if (is_useful(&game->current, &all_actions[i]))
-            actions[end_index++] = all_actions[i];
+    for (int i = 0; i < len_all_moves; i++) {
+        if (is_useful_move_bb(&game->position, color, all_moves[i]))
+            moves[end_index++] = orient_move_(game, all_moves[i]);
     }
 
     if (end_index == 0) {
         // 全ての指手が削除されたとき, 1手も削除しないことにする.
         // コーナーケース
-        for (int i = 0; i < len_all_actions; i++)
-            actions[end_index++] = all_actions[i];
+        for (int i = 0; i < len_all_moves; i++)
+            moves[end_index++] = orient_move_(game, all_moves[i]);
     }
 
     return end_index;
 }
 
 
-int get_perfectly_useful_actions_with_tfr(const Game *game, Action actions[LEN_ACTIONS]) {
+int get_useful_actions_with_tfr(const Game *game, Action actions[LEN_ACTIONS]) {
+    // get_useful_moves_with_tfrのAction版
+    Move moves[LEN_ACTIONS];
+    return moves_to_actions_(moves, get_useful_moves_with_tfr(game, moves), actions);
+}
+
+
+int get_perfectly_useful_moves_with_tfr(const Game *game, Move moves[LEN_ACTIONS]) {
     /*
     有用な指手を列挙する.
     相手の王を詰ませられるときは, その1手を代入する.
@@ -303,43 +716,52 @@ int get_perfectly_useful_actions_with_tfr(const Game *game, Action actions[LEN_A
     そうでないときは, ごく一部の無駄な指手だけを除いて, ほぼ全ての指手を列挙する.
     */
 
-    // 選択可能な指手を全て列挙する.
-    Action all_actions[LEN_ACTIONS];
-    int len_all_actions = get_all_actions_with_tfr(game, all_actions);
-
+    // 駒を取る手, 王手をかける手, それ以外の手の順に選択可能な指手を列挙しながら,
     // 相手の王を詰ませられるかを判定する.
-    for (int i = 0; i < len_all_actions; i++) {
-        do_action((Game *) game, all_actions[i]);
-        int judge_result = judge(game);
-        assert(judge_result != 1);
-        if (judge_result == -1) {
-            // all_actions[i]を行うと相手の王が詰むとき
-            actions[0] = all_actions[i];
-            undo_action((Game *) game);
+    // 指手は先手から見た向きで扱い, 返すときに手番側から見た向きに戻す.
+    const int color = turn_color_(game->turn);
+    MovePicker picker;
+    init_move_picker_bb(&picker, &game->position, color);
+    Move all_moves[LEN_ACTIONS];
+    int len_all_moves = 0;
+    for (Move move = next_move(&picker); move != NULL_MOVE; move = next_move(&picker)) {
+        if (!is_legal_with_tfr_(game, move))
+            continue;
+        if (is_mating_move_with_tfr_(game, move, true)) {
+            // moveを行うと相手の王が詰むとき (後手が通常の千日手を決めるときも含む)
+            moves[0] = orient_move_(game, move);
             return -1;
-        } else {
-            undo_action((Game *) game);
         }
+        all_moves[len_all_moves++] = move;
     }
 
     // ほぼ明らかに無駄な指手以外を列挙する.
     int end_index = 0;
-    for (int i = 0; i < len_all_actions; i++) {
-        if (is_useful(&game->current, &all_actions[i]))
-            actions[end_index++] = all_actions[i];
+    for (int i = 0; i < len_all_moves; i++) {
+        if (is_useful_move_bb(&game->position, color, all_moves[i]))
+            moves[end_index++] = orient_move_(game, all_moves[i]);
     }
 
     if (end_index == 0) {
         // 全ての指手が削除されたとき, 1手も削除しないことにする.
         // コーナーケース
-        for (int i = 0; i < len_all_actions; i++)
-            actions[end_index++] = all_actions[i];
+        for (int i = 0; i < len_all_moves; i++)
+            moves[end_index++] = orient_move_(game, all_moves[i]);
     }
 
     return end_index;
 }
 
 
+int get_perfectly_useful_actions_with_tfr(const Game *game, Action actions[LEN_ACTIONS]) {
+    // get_perfectly_useful_moves_with_tfrのAction版 (詰みの一手が返されるとき戻り値は-1)
+    Move moves[LEN_ACTIONS];
+    int len_moves = get_perfectly_useful_moves_with_tfr(game, moves);
+    moves_to_actions_(moves, (len_moves == -1) ? 1 : len_moves, actions);
+    return len_moves;
+}
+
+
 static void print_all_actions_for_debug(Game *game) {
     // 可能な指手を全て出力する
 
@@ -375,7 +797,7 @@ Action get_previous_action(const Game *game) {
 
     Board previous = decode(game->history[game->history_len - 2]);
     reverse_board(&previous);
-    Board current = game->current;
+    Board current = get_current_board(game);
     reverse_board(&current);
     return delta_of(&previous, &current);
 }
@@ -408,7 +830,7 @@ int play(Game *game, PlayerInterface *player1, PlayerInterface *player2, bool de
     while (game->turn <= game->max_turn) {  // 150手以内
         // デバッグプリント
         if (debug) {
-            Board b = game->current;
+            Board b = get_current_board(game);
             if (game->turn % 2 == 0)
                 reverse_board(&b);
             if (game->turn % 2 == 0)
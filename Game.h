@@ -2,10 +2,12 @@
 #define GAME_H
 
 
+#include <stdint.h>
 #include "gamedef.h"
 #include "Board.h"
 #include "Action.h"
 #include "Hash.h"
+#include "BitBoard.h"
 
 #define MALLOC_MARGIN 8  // mallocで動的確保する時にどれだけ余裕を持って確保するか？
 
@@ -14,6 +16,18 @@
  * Gameクラスの定義
  *********************************/
 
+typedef struct {            // 1手分の盤面の変化を表す構造体 (undo_actionで盤面を戻す際に用いる)
+    Move move;              // 行った指手 (先手から見た向き)
+    int8_t moved_piece;     // 動かした駒 (成る前の駒), 持ち駒を打つ場合は打った駒
+    int8_t captured_piece;  // 取った相手の駒 (成っている場合もそのまま), 取らなかった場合EMPTY
+} UndoRecord;
+
+typedef struct {      // 千日手の判定に用いる, 局面ごとの出現回数を保持するハッシュ表の要素
+    uint64_t key;     // 局面のゾブリストハッシュ値
+    int count;        // 履歴中に現れた回数 (0のときは空き)
+    int first_index;  // 履歴中で最初に現れたインデックス
+} RepetitionEntry;
+
 typedef struct {      // 試合一回分を表す構造体
     Board current;    // 現在の盤面
     int turn;         // 現在のターン
@@ -22,7 +36,15 @@ typedef struct {      // 試合一回分を表す構造体
 
     // 以下のメンバは内部的なもの(プライベート)であり、使用者が意識する必要はない
     // Game構造体はアドレス渡しが主なので、以下がオーバーヘッドになる事はない
-    bool *is_checking_history;  // 各履歴が王手状態にあるか否かを保持する動的配列
+    int8_t *is_checking_history;  // 各履歴が王手状態にあるか否かを保持する動的配列 (千日手の判定で必要になるまで計算しない)
+    UndoRecord *undo_history;   // 各履歴に至る1手分の盤面の変化を保持する動的配列 (undo_history[0]は未使用)
+    uint64_t *key_history;      // 各履歴の局面のゾブリストハッシュ値を保持する動的配列 (千日手の判定に用いる)
+    bool records_hash;          // historyにHashを記録するか否か (偽のときhistory[0]以外は不定となる)
+    RepetitionEntry *repetition_table;  // key_historyの各局面の出現回数を保持する開番地法のハッシュ表
+    int repetition_candidates;          // repetition_tableで出現回数が3回以上の局面の数 (0なら千日手は起こりえない)
+    BitBoard position;          // 先手から見た向きの現在の盤面 ([0]が先手, [1]が後手), 合法手や千日手の判定はこれで行う
+    bool fixed_orientation;     // 真のときcurrentを更新しない (盤面を反転させない探索用のモード, currentは不定となる)
+    int repetition_mask;                // repetition_tableの要素数 - 1 (要素数は2のべき乗)
     int max_turn;     // この構造体が保持できる履歴の最大数
 } Game;
 
@@ -43,8 +65,24 @@ void destruct_game(Game *game);
 
 Game clone(const Game *game, int max_turn);
 
+void set_initial_board(Game *game, const Board *b);
+
+void set_hash_recording(Game *game, bool enabled);
+
+void set_fixed_orientation(Game *game, bool enabled);
+
+Board get_current_board(const Game *game);
+
+uint64_t zobrist_key(const Board *b, int turn);
+
+uint64_t get_zobrist_key(const Game *game);
+
+bool has_repetition_candidates(const Game *game);
+
 void do_action(Game *game, Action action);
 
+void do_move(Game *game, Move move);
+
 void undo_action(Game *game);
 
 int save(const Game *game);
@@ -55,16 +93,24 @@ int is_threefold_repetition(const Game *game, Action action);
 
 int is_threefold_repetition_2(const Game *game);
 
+int get_all_moves_with_tfr(const Game *game, Move all_moves[LEN_ACTIONS]);
+
 int get_all_actions_with_tfr(const Game *game, Action all_actions[LEN_ACTIONS]);
 
 bool is_possible_action_with_tfr(const Game *game, Action action);
 
+int get_check_moves_with_tfr(const Game *game, Move moves[LEN_ACTIONS]);
+
 bool is_checkmate_with_tfr(const Game *game);
 
 int judge(const Game *game);
 
+int get_useful_moves_with_tfr(const Game *game, Move moves[LEN_ACTIONS]);
+
 int get_useful_actions_with_tfr(const Game *game, Action actions[LEN_ACTIONS]);
 
+int get_perfectly_useful_moves_with_tfr(const Game *game, Move moves[LEN_ACTIONS]);
+
 int get_perfectly_useful_actions_with_tfr(const Game *game, Action actions[LEN_ACTIONS]);
 
 Action get_previous_action(const Game *game);
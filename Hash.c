@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include "Hash.h"
 
@@ -14,92 +15,119 @@ typedef union {                       // ハッシュのエンコード及びデ
 } __attribute__((__packed__)) HashField;  // 構造体のザイズがジャスト1byteであることを保証
 
 
+/*
+エンコード・デコードで使う変換表.
+盤上の駒はマスの値 (-MAX_PIECE_NUMBER..MAX_PIECE_NUMBER) にMAX_PIECE_NUMBERを足した値を添字とする.
+*/
+
+#define CELL_INDEX_(piece) ((piece) + MAX_PIECE_NUMBER)
+
+#define EMPTY_KIND_ 6  // 空きマスの書き込み先 (HashFieldの使わない領域)
+
+static const int KIND_OF_CELL[2 * MAX_PIECE_NUMBER + 1] = {  // マスの駒の種類 (FU..OUを0..5とする)
+        [CELL_INDEX_(EMPTY)]=EMPTY_KIND_,
+        [CELL_INDEX_(FU)]=0, [CELL_INDEX_(KAKU)]=1, [CELL_INDEX_(HISHA)]=2,
+        [CELL_INDEX_(GIN)]=3, [CELL_INDEX_(KIN)]=4, [CELL_INDEX_(OU)]=5,
+        [CELL_INDEX_(FU + NARI)]=0, [CELL_INDEX_(KAKU + NARI)]=1,
+        [CELL_INDEX_(HISHA + NARI)]=2, [CELL_INDEX_(GIN + NARI)]=3,
+        [CELL_INDEX_(-FU)]=0, [CELL_INDEX_(-KAKU)]=1, [CELL_INDEX_(-HISHA)]=2,
+        [CELL_INDEX_(-GIN)]=3, [CELL_INDEX_(-KIN)]=4, [CELL_INDEX_(-OU)]=5,
+        [CELL_INDEX_(-FU - NARI)]=0, [CELL_INDEX_(-KAKU - NARI)]=1,
+        [CELL_INDEX_(-HISHA - NARI)]=2, [CELL_INDEX_(-GIN - NARI)]=3
+};
+
+#define BOARD_FIELD_(is_opponent, is_promoted) {.owner=(is_opponent), .promoted=(is_promoted), .is_enabled=1}
+
+static const HashField FIELD_OF_CELL[2 * MAX_PIECE_NUMBER + 1] = {  // マスの駒の所有と成り (indexは埋めずに使う)
+        [CELL_INDEX_(FU)]=BOARD_FIELD_(0, 0), [CELL_INDEX_(KAKU)]=BOARD_FIELD_(0, 0),
+        [CELL_INDEX_(HISHA)]=BOARD_FIELD_(0, 0), [CELL_INDEX_(GIN)]=BOARD_FIELD_(0, 0),
+        [CELL_INDEX_(KIN)]=BOARD_FIELD_(0, 0), [CELL_INDEX_(OU)]=BOARD_FIELD_(0, 0),
+        [CELL_INDEX_(FU + NARI)]=BOARD_FIELD_(0, 1), [CELL_INDEX_(KAKU + NARI)]=BOARD_FIELD_(0, 1),
+        [CELL_INDEX_(HISHA + NARI)]=BOARD_FIELD_(0, 1), [CELL_INDEX_(GIN + NARI)]=BOARD_FIELD_(0, 1),
+        [CELL_INDEX_(-FU)]=BOARD_FIELD_(1, 0), [CELL_INDEX_(-KAKU)]=BOARD_FIELD_(1, 0),
+        [CELL_INDEX_(-HISHA)]=BOARD_FIELD_(1, 0), [CELL_INDEX_(-GIN)]=BOARD_FIELD_(1, 0),
+        [CELL_INDEX_(-KIN)]=BOARD_FIELD_(1, 0), [CELL_INDEX_(-OU)]=BOARD_FIELD_(1, 0),
+        [CELL_INDEX_(-FU - NARI)]=BOARD_FIELD_(1, 1), [CELL_INDEX_(-KAKU - NARI)]=BOARD_FIELD_(1, 1),
+        [CELL_INDEX_(-HISHA - NARI)]=BOARD_FIELD_(1, 1), [CELL_INDEX_(-GIN - NARI)]=BOARD_FIELD_(1, 1)
+};
+
+static const HashField STOCK_FIELD[2] = {  // 持ち駒 ([0]は自分, [1]は相手)
+        {.index=25, .owner=0, .promoted=0, .is_enabled=1},
+        {.index=25, .owner=1, .promoted=0, .is_enabled=1}
+};
+
+#define SIGNED_PIECES_(piece) {{(piece), (piece) + NARI}, {-(piece), -((piece) + NARI)}}
+
+static const int8_t PIECE_OF_FIELD[6][2][2] = {  // [駒の種類][所有][成り] から盤上のマスの値への変換表
+        SIGNED_PIECES_(FU), SIGNED_PIECES_(KAKU), SIGNED_PIECES_(HISHA),
+        SIGNED_PIECES_(GIN), SIGNED_PIECES_(KIN), SIGNED_PIECES_(OU)
+};
+
+
+static inline void sort_pairs_(HashField field[8][2]) {
+    // 各駒に割り当てられた2byteを値の小さい順に並べる (分岐のない比較で書き, cmovに落とせるようにする)
+    for (int kind = 0; kind < 6; ++kind) {
+        unsigned char first = field[kind][0].to_char, second = field[kind][1].to_char;
+        field[kind][0].to_char = (first < second) ? first : second;
+        field[kind][1].to_char = (first < second) ? second : first;
+    }
+}
+
+
+#ifdef DEBUG_MODE
+static void check_fields_(HashField field[8][2], const char *caller) {
+    // 各種類の駒がちょうど2枚ずつあるかを確かめる
+    for (int kind = 0; kind < 6; ++kind) {
+        if (!field[kind][0].is_enabled || !field[kind][1].is_enabled)
+            debug_print("in %s: the number of a certain kind of pieces is less than 2.", caller);
+    }
+}
+#endif  /* DEBUG_MODE */
+
+
 Hash encode(const Board *b) {
     // 盤面bを96bitのハッシュに潰す
     // 駒は2枚×6種であり、各種別ごとに2byteのフィールドを与える (計96bit)
     // 2byteは値の小さい順にソートし、一意性を確保する
 
     HashField field[8][2] = {};  // Hashへのキャストの都合上インデックスを6ではなく8としている
+    int len_field[7] = {};       // 各種類の駒について, fieldに詰めた枚数
 
     // 盤面を探索し、fieldに駒の情報を詰める
-    for (int i = 0; i < 5; ++i) {
-        for (int j = 0; j < 5; ++j) {
-            int piece = b->board[i][j];
-
-            if (piece != EMPTY) {
-                int kind_of_piece = (abs(piece) != OU) ? abs(piece) % NARI : OU;
-                HashField *hf = &field[kind_of_piece - 1][0];
-
-                if (hf->is_enabled)
-                    ++hf;
-
-                if (hf->is_enabled)
-                    debug_print("in encode: three same kind of piece does exist.");
-
-                hf->index = i * 5 + j;
-                hf->owner = (piece > 0) ? 0 : 1;
-                hf->promoted = (abs(piece) > NARI) ? 1 : 0;
-                hf->is_enabled = 1;
-            }
-        }
+    // 空きマスの有無で分岐すると予測が外れやすいので, 空きマスもfield[EMPTY_KIND_]に書き込んで後で消す
+    // 同じ種類の駒が3枚以上ある不正な盤面でも, 配列の外には書き込まない
+    const int8_t *cells = &b->board[0][0];
+    for (int square = 0; square < 25; ++square) {
+        int cell = CELL_INDEX_(cells[square]);
+        int kind = KIND_OF_CELL[cell];
+        HashField hf = FIELD_OF_CELL[cell];
+        hf.index = square;
+        field[kind][len_field[kind]++ & 1] = hf;
     }
-
-    // 自分の持ち駒を探索し、fieldに駒の情報を詰める
-    for (int piece = FU; piece <= KIN; ++piece) {
-        int number_of_piece = b->next_stock[piece];
-
-        for (int i = 0; i < number_of_piece; ++i) {
-            HashField *hf = &field[piece - 1][0];
-            if (hf->is_enabled)
-                ++hf;
-
-            if (hf->is_enabled)
-                debug_print("in encode: three same kind of piece does exist.");
-
-            hf->index = 25;
-            hf->owner = 0;
-            hf->promoted = 0;
-            hf->is_enabled = 1;
-        }
-    }
-
-    // 相手の持ち駒を探索し、fieldに駒の情報を詰める
-    for (int piece = FU; piece <= KIN; ++piece) {
-        int number_of_piece = b->previous_stock[piece];
-
-        for (int i = 0; i < number_of_piece; ++i) {
-            HashField *hf = &field[piece - 1][0];
-            if (hf->is_enabled)
-                ++hf;
-
-            if (hf->is_enabled)
-                debug_print("in encode: three same kind of piece does exist.");
-
-            hf->index = 25;
-            hf->owner = 1;
-            hf->promoted = 0;
-            hf->is_enabled = 1;
-        }
+    field[EMPTY_KIND_][0].to_char = field[EMPTY_KIND_][1].to_char = 0;
+
+    // 持ち駒を探索し、fieldに駒の情報を詰める
+    for (int kind = 0; kind < 5; ++kind) {
+        for (int i = 0; i < b->next_stock[kind + 1]; ++i)
+            field[kind][len_field[kind]++ & 1] = STOCK_FIELD[0];
+        for (int i = 0; i < b->previous_stock[kind + 1]; ++i)
+            field[kind][len_field[kind]++ & 1] = STOCK_FIELD[1];
     }
 
-    // 各駒に割り当てられた2byteをソートする
-    for (int i = 0; i < 6; ++i) {
-        if (!field[i][0].is_enabled || !field[i][1].is_enabled)
-            debug_print("in encode: the number of a certain kind of pieces is less than 2.");
+#ifdef DEBUG_MODE
+    check_fields_(field, "encode");
+#endif  /* DEBUG_MODE */
 
-        if (field[i][0].to_char > field[i][1].to_char) {
-            HashField memo = field[i][0];
-            field[i][0] = field[i][1];
-            field[i][1] = memo;
-        }
-    }
+    sort_pairs_(field);
 
     // コンパイラによるアラインによって Hash <-> HashField[16] 間のキャストが
     // 失敗する可能性があるため、static_assertでコンパイル時にエラーチェックする
     static_assert(sizeof(field) == 16, "sizeof(field) != 16");
     static_assert(sizeof(Hash) == 16, "sizeof(Hash) != 16");
 
-    return *((Hash *) field);
+    Hash h;
+    memcpy(&h, field, sizeof(h));
+    return h;
 }
 
 
@@ -107,33 +135,25 @@ Board decode(Hash h) {
     // ハッシュ値hをBoardに展開する
 
     Board b = {};
-    HashField (*field)[2] = (HashField (*)[2]) &h;  // ハッシュhを HashField の配列に展開
+    HashField field[8][2];
+    memcpy(field, &h, sizeof(field));  // ハッシュhを HashField の配列に展開
 
-    for (int piece = FU; piece <= OU; ++piece) {  // 各駒のハッシュを元に盤面bを埋める
+#ifdef DEBUG_MODE
+    check_fields_(field, "decode");
+#endif  /* DEBUG_MODE */
+
+    int8_t *cells = &b.board[0][0];
+    uint8_t *stocks[2] = {b.next_stock, b.previous_stock};
+    for (int kind = 0; kind < 6; ++kind) {  // 各駒のハッシュを元に盤面bを埋める
         for (int i = 0; i < 2; ++i) {
-            HashField hash = field[piece - 1][i];
-
-            if (hash.is_enabled == 0)
-                debug_print("in decode the number of a certain kind of pieces is less than 2.");
-
-            int index = hash.index;
-            if (index < 25) {  // 駒が盤上にある場合
-                // 駒pieceに成りの情報と所有の情報を付け加える
-                int piece_with_owner = (hash.promoted) ? piece + NARI : piece;
-                piece_with_owner *= (hash.owner) ? -1 : 1;
-
-                // 盤面に配置
-                b.board[index / 5][index % 5] = piece_with_owner;
-            } else if (index == 25) {  // 駒が持ち駒である場合
-                if (hash.promoted)
-                    debug_print("in decode: promoted flag of a piece in stock is True.");
-
-                if (hash.owner == 0) {  // 自分の駒である場合
-                    ++b.next_stock[piece];
-                } else {  // 相手の駒である場合
-                    ++b.previous_stock[piece];
-                }
-            }
+            HashField hf = field[kind][i];
+            if (!hf.is_enabled)
+                continue;
+
+            if (hf.index < 25)  // 駒が盤上にある場合
+                cells[hf.index] = PIECE_OF_FIELD[kind][hf.owner][hf.promoted];
+            else if (hf.index == 25)  // 駒が持ち駒である場合
+                ++stocks[hf.owner][kind + 1];
         }
     }
 
@@ -142,26 +162,22 @@ Board decode(Hash h) {
 
 
 Hash reverse_hash(Hash h) {
-    HashField (*field)[2] = (HashField (*)[2]) &h;
+    HashField field[8][2];
+    memcpy(field, &h, sizeof(field));
 
-    for (int piece = FU; piece <= OU; ++piece) {
+    for (int kind = 0; kind < 6; ++kind) {
         for (int i = 0; i < 2; ++i) {
-            HashField *hf = &field[piece - 1][i];
+            HashField *hf = &field[kind][i];
             hf->owner = 1 - hf->owner;
             if (hf->index != 25)
                 hf->index = 24 - hf->index;
         }
     }
 
-    for (int i = 0; i < 6; ++i) {
-        if (field[i][0].to_char > field[i][1].to_char) {
-            HashField memo = field[i][0];
-            field[i][0] = field[i][1];
-            field[i][1] = memo;
-        }
-    }
+    sort_pairs_(field);
 
-    return *((Hash *) field);
+    memcpy(&h, field, sizeof(h));
+    return h;
 }
 
 
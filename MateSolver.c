@@ -0,0 +1,158 @@
+#include <string.h>
+#include <time.h>
+#include "MateSolver.h"
+
+
+/*
+王手をかける手だけを読んで, 手番側 (攻め方) が相手 (玉方) を詰ませられるかを調べる.
+攻め方は王手をかける手, 玉方は全ての合法手を指すものとし, 1手, 3手, 5手, ...と読む手数を増やしていく.
+千日手は反則手の判定には考慮するが, 王手でない手で相手の合法手をなくす勝ち (千日手による勝ちなど) は読まない.
+*/
+
+
+typedef struct {                 // 詰み探索の途中の状態を表す構造体
+    Game game;                   // 探索中の局面
+    MateLimits limits;           // 探索の上限
+    long long nodes;             // 探索したノード数
+    struct timespec start_time;  // 探索を開始した時刻
+    bool aborted;                // 上限に達して探索を打ち切ったか否か
+} MateSearch;
+
+
+static bool is_over_limits_(MateSearch *search) {
+    // ノード数か時間の上限に達したかを判定する. 時間は1024ノードごとに調べる.
+    if (search->aborted)
+        return true;
+
+    if (search->limits.max_nodes > 0 && search->nodes >= search->limits.max_nodes) {
+        search->aborted = true;
+    } else if (search->limits.max_seconds > 0 && (search->nodes & 1023) == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (stop_watch(search->start_time, now) >= search->limits.max_seconds)
+            search->aborted = true;
+    }
+    return search->aborted;
+}
+
+
+static int defend_(MateSearch *search, int depth, Move line[MAX_MATE_DEPTH]);
+
+
+static int attack_(MateSearch *search, int depth, Move line[MAX_MATE_DEPTH]) {
+    /*
+    攻め方の手番で, depth手以内に詰ませられるかを調べる.
+    詰ませられるときは詰みまでの手順をlineに代入してその手数を返し, そうでなければ0を返す.
+    */
+    Game *game = &search->game;
+    Move moves[LEN_ACTIONS];
+    int len_moves = get_check_moves_with_tfr(game, moves);
+
+    // 1手詰めを先に調べる.
+    for (int i = 0; i < len_moves; i++) {
+        do_move(game, moves[i]);
+        ++search->nodes;
+        bool is_mate = is_checkmate_with_tfr(game);
+        undo_action(game);
+        if (is_mate) {
+            line[0] = moves[i];
+            return 1;
+        }
+    }
+    if (depth < 3)
+        return 0;
+
+    for (int i = 0; i < len_moves; i++) {
+        if (is_over_limits_(search))
+            return 0;
+        Move sub_line[MAX_MATE_DEPTH];
+        do_move(game, moves[i]);
+        int len_sub_line = defend_(search, depth - 1, sub_line);
+        undo_action(game);
+        if (len_sub_line > 0) {
+            line[0] = moves[i];
+            memcpy(line + 1, sub_line, len_sub_line * sizeof(Move));
+            return len_sub_line + 1;
+        }
+    }
+    return 0;
+}
+
+
+static int defend_(MateSearch *search, int depth, Move line[MAX_MATE_DEPTH]) {
+    /*
+    王手された玉方の手番で, どう応じてもdepth手以内に詰むかを調べる.
+    詰むときは最も長く逃れる応手からの手順をlineに代入してその手数を返し, そうでなければ0を返す.
+    */
+    Game *game = &search->game;
+    Move moves[LEN_ACTIONS];
+    int len_moves = get_all_moves_with_tfr(game, moves);
+
+    int len_line = 0;
+    for (int i = 0; i < len_moves; i++) {
+        Move sub_line[MAX_MATE_DEPTH];
+        do_move(game, moves[i]);
+        ++search->nodes;
+        int len_sub_line = attack_(search, depth - 1, sub_line);
+        undo_action(game);
+        if (len_sub_line == 0)
+            // 詰みを逃れる応手があるとき
+            return 0;
+        if (len_sub_line + 1 > len_line) {
+            line[0] = moves[i];
+            memcpy(line + 1, sub_line, len_sub_line * sizeof(Move));
+            len_line = len_sub_line + 1;
+        }
+    }
+    return len_line;
+}
+
+
+MateResult solve_mate(const Game *game, MateLimits limits) {
+    /*
+    gameの現在の局面で, 手番側がlimits.max_depth手以内に相手を詰ませられるかを調べる.
+    短い手数から順に読むので, 見つかる詰みは最短のものである.
+    gameは変更しない (内部で複製して探索する).
+    */
+    if (limits.max_depth > MAX_MATE_DEPTH)
+        limits.max_depth = MAX_MATE_DEPTH;
+
+    MateSearch search = {
+            .game=clone(game, game->history_len + limits.max_depth),
+            .limits=limits,
+            .nodes=0,
+            .aborted=false
+    };
+    set_fixed_orientation(&search.game, true);
+    set_hash_recording(&search.game, false);
+    clock_gettime(CLOCK_MONOTONIC, &search.start_time);
+
+    MateResult result = {.status=MATE_NOT_FOUND, .len_line=0};
+    for (int depth = 1; depth <= limits.max_depth; depth += 2) {
+        result.len_line = attack_(&search, depth, result.line);
+        if (result.len_line > 0) {
+            result.status = MATE_FOUND;
+            break;
+        }
+        if (search.aborted) {
+            result.status = MATE_UNKNOWN;
+            break;
+        }
+    }
+
+    result.nodes = search.nodes;
+    destruct_game(&search.game);
+    return result;
+}
+
+
+MateResult solve_mate_board(const Board *b, MateLimits limits) {
+    // 盤面bで, 手番側がlimits.max_depth手以内に相手を詰ませられるかを調べる.
+    // 手番側を先手とみなし, 履歴のない局面として探索する.
+
+    Game game = create_game(MAX_MATE_DEPTH + 1);
+    set_initial_board(&game, b);
+    MateResult result = solve_mate(&game, limits);
+    destruct_game(&game);
+    return result;
+}
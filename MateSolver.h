@@ -0,0 +1,46 @@
+#ifndef MATESOLVER_H
+#define MATESOLVER_H
+
+
+#include "gamedef.h"
+#include "Action.h"
+#include "Board.h"
+#include "Game.h"
+
+#define MAX_MATE_DEPTH 31  // 詰み探索で読む手数の最大値
+
+
+/*********************************
+ * MateSolverクラスの定義
+ *********************************/
+
+typedef enum {       // 詰み探索の結果
+    MATE_FOUND,      // 詰みが見つかった
+    MATE_NOT_FOUND,  // 指定された手数以内に詰みがないことが分かった
+    MATE_UNKNOWN     // ノード数か時間の上限に達したため分からない
+} MateStatus;
+
+typedef struct {          // 詰み探索の上限
+    int max_depth;        // 読む手数の上限 (攻め方と玉方の手の合計, MAX_MATE_DEPTHを超える場合はMAX_MATE_DEPTHとする)
+    long long max_nodes;  // 探索するノード数の上限 (0以下なら上限なし)
+    double max_seconds;   // 探索時間の上限[秒] (0以下なら上限なし)
+} MateLimits;
+
+typedef struct {                // 詰み探索の結果を表す構造体
+    MateStatus status;          // 探索の結果
+    Move line[MAX_MATE_DEPTH];  // 詰みまでの手順 (各指手はその指手を指す側から見た向き)
+    int len_line;               // 詰みまでの手数 (詰みが見つからなかった場合は0)
+    long long nodes;            // 探索したノード数
+} MateResult;
+
+
+/*********************************
+ * MateSolverクラスのメソッド
+ *********************************/
+
+MateResult solve_mate(const Game *game, MateLimits limits);
+
+MateResult solve_mate_board(const Board *b, MateLimits limits);
+
+
+#endif  /* MATESOLVER_H */
@@ -3,14 +3,22 @@
 #include <string.h>
 #include <assert.h>
 #include <unistd.h>
+#include <sched.h>
 
 #include "MultiThread.h"
+#include "MateSolver.h"
+#include "DfpnSolver.h"
+#include "CpuAffinity.h"
 
 
-Heap construct_heap(size_t max_size) {
+_Static_assert(MAX_NUMBER_OF_THREADS + 1 <= MAX_NODE_ARENAS, "too many threads for the node arenas");
+_Static_assert(LEN_ACTIONS * sizeof(PNode) <= ARENA_MAX_BLOCK_SIZE, "heap buffers must fit in an arena block");
+
+
+Heap construct_heap(NodeArena *arena, size_t max_size) {
     assert(max_size != 0);
     return (Heap) {
-            .buf=(PNode *) malloc(max_size * sizeof(PNode)),
+            .buf=(PNode *) arena_alloc(arena, max_size * sizeof(PNode)),
             .max_size=max_size,
             .current_size=0
     };
@@ -18,7 +26,7 @@ Heap construct_heap(size_t max_size) {
 
 
 void destruct_heap(Heap *heap) {
-    free(heap->buf);
+    arena_free(heap->buf);
     heap->buf = NULL;
 }
 
@@ -105,17 +113,19 @@ void heap_push(Heap *heap, PNode node) {
 }
 
 
-PNode construct_node(bool is_leaf, Action action, int player, PNode parent, size_t index_in_parents_heap) {
-    PNode res = (PNode) malloc(sizeof(Node));
+PNode construct_node(NodeArena *arena, bool is_leaf, Move move, int player, PNode parent, size_t index_in_parents_heap) {
+    PNode res = (PNode) arena_alloc(arena, sizeof(Node));
 
     Node node = (Node) {
             .parent=parent,
             .index_in_parents_heap_=index_in_parents_heap,
             .is_leaf=is_leaf,
-            .action=action,
+            .move=move,
             .player=player,
             .children={},
             .value_for_heap=0,
+            .lock_=ATOMIC_FLAG_INIT,
+            .is_collapsed_=false,
     };
 
     memcpy(res, &node, sizeof(Node));
@@ -127,19 +137,35 @@ PNode construct_node(bool is_leaf, Action action, int player, PNode parent, size
 void destruct_node(PNode node) {
     destruct_heap(&node->children);
     node->parent = NULL;
-    free(node);
+    arena_free(node);
 }
 
 
-void destruct_node_recursively(PNode root) {
+static void release_node_(PNode node, ArenaBatch *batch) {
+    // destruct_nodeと同じだが, 領域はbatchにまとめてからアリーナに返す
+    arena_batch_free(batch, node->children.buf);
+    node->children.buf = NULL;
+    node->parent = NULL;
+    arena_batch_free(batch, node);
+}
+
+
+static void release_node_recursively_(PNode root, ArenaBatch *batch) {
     if (root->is_leaf) {
-        assert(root->value_for_heap == 0 || root->value_for_heap == INF_DEPTH);
-        destruct_node(root);
+        assert(root->value_for_heap == 0 || root->value_for_heap == INF_DEPTH || root->is_collapsed_);
     } else {
         for (size_t i = 0; i < root->children.current_size; ++i)
-            destruct_node_recursively(root->children.buf[i]);
-        destruct_node(root);
+            release_node_recursively_(root->children.buf[i], batch);
     }
+    release_node_(root, batch);
+}
+
+
+void destruct_node_recursively(PNode root) {
+    // 部分木の全ノードを解放する. 所有するアリーナごとにまとめて返すので, アリーナへの書き込みは数回で済む
+    ArenaBatch batch = {};
+    release_node_recursively_(root, &batch);
+    arena_batch_flush(&batch);
 }
 
 
@@ -149,101 +175,371 @@ size_t get_index_in_parents_heap(PNode self) {
 
 
 bool being_edited(PNode node) {
-    return (node->is_leaf) && (node->value_for_heap != 0 && node->value_for_heap != INF_DEPTH);
+    // 畳まれた葉は, 畳む前のvalue_for_heapを残しているが編集中ではない
+    return (node->is_leaf) && !node->is_collapsed_ && (node->value_for_heap != 0 && node->value_for_heap != INF_DEPTH);
+}
+
+
+static atomic_ulong lock_contention_count_ = 0;  // lock_nodeとゲーム木の読み書きロックで待たされた回数
+
+
+void lock_node(PNode node) {
+    // 取れるまで回り続ける. 同じCPUで動くロックの保持者を妨げないよう, しばらく取れなければCPUを譲る
+    if (!atomic_flag_test_and_set_explicit(&node->lock_, memory_order_acquire))
+        return;
+
+    atomic_fetch_add_explicit(&lock_contention_count_, 1, memory_order_relaxed);
+    for (int spin = 1; atomic_flag_test_and_set_explicit(&node->lock_, memory_order_acquire); ++spin) {
+        if (spin % 64 == 0)
+            sched_yield();
+    }
+}
+
+
+void unlock_node(PNode node) {
+    atomic_flag_clear_explicit(&node->lock_, memory_order_release);
+}
+
+
+unsigned long get_lock_contention_count(void) {
+    return atomic_load_explicit(&lock_contention_count_, memory_order_relaxed);
+}
+
+
+static inline bool is_leaf_(PNode node) {
+    // 展開を終えた探索者がis_leafを偽にするまでにchildrenが書き込まれていることを保証する
+    return __atomic_load_n(&node->is_leaf, __ATOMIC_ACQUIRE);
+}
+
+
+static void read_lock_game_tree_(SharedResources *rsc) {
+    // pthreadの読み書きロックは読み込みを優先するので, 探索者が絶えず読み込みロックを取ると根の付け替えが進まない
+    // 書き込みを待っているスレッドがいる間は, 新しく読み込みロックを取らずに待つ
+    if (atomic_load(&rsc->writers_waiting_) == 0 && pthread_rwlock_tryrdlock(&rsc->game_tree_lock) == 0)
+        return;
+
+    atomic_fetch_add_explicit(&lock_contention_count_, 1, memory_order_relaxed);
+    while (atomic_load(&rsc->writers_waiting_) != 0)
+        sched_yield();
+    pthread_rwlock_rdlock(&rsc->game_tree_lock);
+}
+
+
+static void write_lock_game_tree_(SharedResources *rsc) {
+    atomic_fetch_add(&rsc->writers_waiting_, 1);
+    pthread_rwlock_wrlock(&rsc->game_tree_lock);
+    atomic_fetch_sub(&rsc->writers_waiting_, 1);
 }
 
 
-GarbageQueue construct_garbage_queue(size_t max_size) {
-    ++max_size;
+static GarbageChunk *new_garbage_chunk_(GarbageQueue *queue, size_t start_position) {
+    // 再利用を待つチャンクがあればそれを, なければ新しく確保したチャンクを返す (全てのslotはreadyが偽)
+    GarbageChunk *chunk = atomic_exchange(&queue->spare_chunk_, NULL);
+    if (chunk == NULL) {
+        chunk = (GarbageChunk *) calloc(1, sizeof(GarbageChunk));
+        assert(chunk != NULL);
+    }
+    atomic_store_explicit(&chunk->next, NULL, memory_order_relaxed);
+    chunk->retired_next = NULL;
+    chunk->start_position = start_position;
+    return chunk;
+}
+
+
+static void recycle_garbage_chunk_(GarbageQueue *queue, GarbageChunk *chunk) {
+    // 使い終わったチャンクを再利用のために残す (既に1つ残っていれば解放する)
+    GarbageChunk *expected = NULL;
+    if (!atomic_compare_exchange_strong(&queue->spare_chunk_, &expected, chunk))
+        free(chunk);
+}
 
+
+GarbageQueue construct_garbage_queue(void) {
     GarbageQueue q = {
-            .buf=(Garbage *) malloc(max_size * sizeof(Garbage)),
-            .max_size=max_size,
-            .start_index=0,
-            .end_index=0,
-            .lock=PTHREAD_MUTEX_INITIALIZER
+            .end_position_=0,
+            .tail_chunk_=NULL,
+            .pushers_=0,
+            .spare_chunk_=NULL,
+            .start_position_=0,
+            .max_depth_=0,
+            .head_chunk_=NULL,
+            .retired_chunks_=NULL
     };
 
-    assert(q.buf != NULL);
+    GarbageChunk *chunk = new_garbage_chunk_(&q, 0);
+    atomic_init(&q.tail_chunk_, chunk);
+    q.head_chunk_ = chunk;
 
     return q;
 }
 
 
 void destruct_garbage_queue(GarbageQueue *queue) {
-    assert(queue->start_index == queue->end_index);
-    pthread_mutex_lock(&queue->lock);
-    free(queue->buf);
-    queue->buf = NULL;
-    pthread_mutex_destroy(&queue->lock);
+    // 他のスレッドがプッシュしていないときに呼ぶこと
+    assert(get_garbage_queue_depth(queue) == 0);
+
+    for (GarbageChunk *chunk = queue->head_chunk_, *next; chunk != NULL; chunk = next) {
+        next = atomic_load(&chunk->next);
+        free(chunk);
+    }
+    for (GarbageChunk *chunk = queue->retired_chunks_, *next; chunk != NULL; chunk = next) {
+        next = chunk->retired_next;
+        free(chunk);
+    }
+    free(atomic_load(&queue->spare_chunk_));
+
+    queue->head_chunk_ = NULL;
+    queue->retired_chunks_ = NULL;
+    atomic_store(&queue->tail_chunk_, NULL);
+    atomic_store(&queue->spare_chunk_, NULL);
 }
 
 
-Garbage garbage_queue_pop(GarbageQueue *queue) {
-    pthread_mutex_lock(&queue->lock);
+static void release_retired_chunks_(GarbageQueue *queue) {
+    // 使い終わったチャンクを, プッシュする側が参照しなくなっていれば再利用に回す
+    // プッシュは辿ったチャンクまでtail_chunk_を進めてから終わるので, プッシュの途中のスレッドがいない瞬間には
+    // tail_chunk_は最後に連結したチャンクを指している. その後にプッシュを始めたスレッドは使い終わったチャンクを辿らない
+    GarbageChunk *chunk = queue->retired_chunks_;
+    if (chunk == NULL || atomic_load(&queue->pushers_) != 0)
+        return;
 
-    if (queue->start_index == queue->end_index) {
-        pthread_mutex_unlock(&queue->lock);
-        return (Garbage) {};
+    while (chunk != NULL) {
+        GarbageChunk *next = chunk->retired_next;
+        recycle_garbage_chunk_(queue, chunk);
+        chunk = next;
+    }
+    queue->retired_chunks_ = NULL;
+}
+
+
+static GarbageSlot *front_slot_(GarbageQueue *queue) {
+    // 先頭の要素が入っているslotを返す. 要素がないか, 書き込みの途中であればNULLを返す
+    GarbageChunk *chunk = queue->head_chunk_;
+    size_t offset = atomic_load_explicit(&queue->start_position_, memory_order_relaxed) - chunk->start_position;
+
+    if (offset == GARBAGE_CHUNK_SIZE) {
+        GarbageChunk *next = atomic_load(&chunk->next);
+        if (next == NULL)
+            return NULL;
+
+        queue->head_chunk_ = next;
+        chunk->retired_next = queue->retired_chunks_;
+        queue->retired_chunks_ = chunk;
+
+        chunk = next;
+        offset = 0;
     }
+    release_retired_chunks_(queue);
+
+    GarbageSlot *slot = &chunk->slots[offset];
+    return (atomic_load(&slot->ready)) ? slot : NULL;
+}
+
+
+Garbage garbage_queue_front(GarbageQueue *queue) {
+    GarbageSlot *slot = front_slot_(queue);
+    return (slot == NULL) ? (Garbage) {} : slot->garbage;
+}
+
 
-    Garbage res = queue->buf[queue->start_index];
-    queue->start_index = (queue->start_index + 1) % queue->max_size;
+Garbage garbage_queue_pop(GarbageQueue *queue) {
+    GarbageSlot *slot = front_slot_(queue);
+    if (slot == NULL)
+        return (Garbage) {};
+
+    Garbage res = slot->garbage;
+    atomic_store_explicit(&slot->ready, false, memory_order_relaxed);  // チャンクを再利用するときのために戻しておく
 
-    pthread_mutex_unlock(&queue->lock);
+    size_t depth = get_garbage_queue_depth(queue);
+    if (depth > atomic_load_explicit(&queue->max_depth_, memory_order_relaxed))
+        atomic_store_explicit(&queue->max_depth_, depth, memory_order_relaxed);
+    atomic_fetch_add_explicit(&queue->start_position_, 1, memory_order_release);
 
     return res;
 }
 
 
-bool garbage_queue_push(GarbageQueue *queue, Garbage garbage) {
-    pthread_mutex_lock(&queue->lock);
+void garbage_queue_push(GarbageQueue *queue, Garbage garbage) {
+    // 通し番号をアトミックに1つ取り, その番号のslotが入るチャンクまで末尾から辿って書き込む
+    // チャンクが足りなければ作って連結する (同時に作ったスレッドがあれば, 連結に成功した方を使う)
+    atomic_fetch_add(&queue->pushers_, 1);
 
-    size_t increased_end_index = (queue->end_index + 1) % queue->max_size;
-    if (queue->start_index == increased_end_index) {
-        pthread_mutex_unlock(&queue->lock);
-        return false;
+    GarbageChunk *chunk = atomic_load(&queue->tail_chunk_);
+    const size_t position = atomic_fetch_add(&queue->end_position_, 1);
+    assert(chunk->start_position <= position);
+
+    while (position >= chunk->start_position + GARBAGE_CHUNK_SIZE) {
+        GarbageChunk *next = atomic_load(&chunk->next);
+        if (next == NULL) {
+            GarbageChunk *new_chunk = new_garbage_chunk_(queue, chunk->start_position + GARBAGE_CHUNK_SIZE);
+            if (atomic_compare_exchange_strong(&chunk->next, &next, new_chunk))
+                next = new_chunk;
+            else
+                recycle_garbage_chunk_(queue, new_chunk);
+        }
+
+        GarbageChunk *expected = chunk;
+        atomic_compare_exchange_strong(&queue->tail_chunk_, &expected, next);
+        chunk = next;
     }
 
-    queue->buf[queue->end_index] = garbage;
-    queue->end_index = increased_end_index;
+    GarbageSlot *slot = &chunk->slots[position - chunk->start_position];
+    slot->garbage = garbage;
+    atomic_store(&slot->ready, true);
 
-    pthread_mutex_unlock(&queue->lock);
+    atomic_fetch_sub(&queue->pushers_, 1);
+}
 
-    return true;
+
+size_t get_garbage_queue_depth(const GarbageQueue *queue) {
+    // プッシュの途中の要素も含む
+    return atomic_load_explicit(&queue->end_position_, memory_order_relaxed) -
+           atomic_load_explicit(&queue->start_position_, memory_order_relaxed);
+}
+
+
+size_t get_garbage_queue_max_depth(const GarbageQueue *queue) {
+    // max_depth_はポップのときにしか更新しないので, 今の長さとの大きい方を返す
+    size_t max_depth = atomic_load_explicit(&queue->max_depth_, memory_order_relaxed);
+    size_t depth = get_garbage_queue_depth(queue);
+    return (depth > max_depth) ? depth : max_depth;
+}
+
+
+size_t get_garbage_queue_popped(const GarbageQueue *queue) {
+    return atomic_load_explicit(&queue->start_position_, memory_order_relaxed);
+}
+
+
+size_t get_garbage_queue_pushed(const GarbageQueue *queue) {
+    return atomic_load_explicit(&queue->end_position_, memory_order_relaxed);
 }
 
 
 bool is_null_garbage(Garbage garbage) {
-    return (garbage.root == NULL) && (garbage.timing_of_delete == 0);
+    return garbage.root == NULL;
+}
+
+
+enum {                            // SharedResources.reclaimer_waiting_ の値
+    RECLAIMER_RUNNING_,           // GarbageCollectorは眠っていない
+    RECLAIMER_WAITS_GARBAGE_,     // ゴミが積まれるのを待っている
+    RECLAIMER_WAITS_EXPLORERS_    // 探索者が新しいエポックを宣言するのを待っている
+};
+
+
+static void wake_reclaimer_(SharedResources *rsc, int reason) {
+    // GarbageCollectorがreasonを待って眠っていれば起こす
+    // 呼ぶ前に待ち合わせの条件 (ゴミのプッシュやエポックの宣言) を書き込んでおくこと
+    if (atomic_load(&rsc->reclaimer_waiting_) != reason)
+        return;
+
+    pthread_mutex_lock(&rsc->reclaimer_lock);
+    pthread_cond_signal(&rsc->reclaimer_cond);
+    pthread_mutex_unlock(&rsc->reclaimer_lock);
+}
+
+
+static void notify_root_change_(SharedResources *rsc) {
+    // 根の付け替えを待って眠っている探索者を全て起こす
+    // 呼ぶ前に待ち合わせの条件 (action_index_やis_going_to_finish_) を書き込んでおくこと
+    pthread_mutex_lock(&rsc->root_change_lock);
+    pthread_cond_broadcast(&rsc->root_change_cond);
+    pthread_mutex_unlock(&rsc->root_change_lock);
+}
+
+
+static void retire_(SharedResources *rsc, PNode root) {
+    // ゲーム木から外した木rootをゴミとしてキューに積む (外した後に呼ぶこと)
+    Garbage garbage = {.root=root, .epoch=atomic_load(&rsc->global_epoch_)};
+    garbage_queue_push(&rsc->garbage_queue, garbage);
+    wake_reclaimer_(rsc, RECLAIMER_WAITS_GARBAGE_);
 }
 
 
-SharedResources *construct_shared_resources(const Game *initial_game_state, bool is_first_player) {
+static inline NodeArena *main_thread_arena_(SharedResources *self) {
+    // メインスレッド (根の付け替えを行うスレッド) が使うアリーナ
+    return &self->node_arenas[self->number_of_explorers];
+}
+
+
+SharedResources *construct_shared_resources(
+        const Game *initial_game_state,
+        bool is_first_player,
+        SearchEngine search_engine,
+        int number_of_explorers,
+        size_t memory_budget
+) {
+    assert(1 <= number_of_explorers && number_of_explorers <= MAX_NUMBER_OF_THREADS);
+    assert(memory_budget > 0);
+
     SharedResources shared_resources = (SharedResources) {
             .initial_game_state=clone(initial_game_state, initial_game_state->max_turn),
+            .is_first_player=is_first_player,
+            .search_engine=search_engine,
             .action_history={},
-            .garbage_queue=construct_garbage_queue(MAX_GARBAGE_QUEUE_SIZE),
-            .game_tree_lock=PTHREAD_MUTEX_INITIALIZER,
+            .garbage_queue=construct_garbage_queue(),
+            .game_tree_lock=PTHREAD_RWLOCK_INITIALIZER,
+            // 置換表は探索の方法に応じてどちらか一方だけを確保する
+            .transposition_table=(search_engine == SEARCH_ENGINE_HEAP) ? construct_transposition_table(TRANSPOSITION_BITS)
+                                                                       : (TranspositionTable) {},
+            .dfpn_table=(search_engine == SEARCH_ENGINE_HEAP) ? (DfpnTable) {}
+                                                              : construct_dfpn_table(DFPN_TABLE_BITS),
+            .number_of_explorers=number_of_explorers,
+            // アリーナは64byte境界に揃える必要がある
+            .node_arenas=(NodeArena *) aligned_alloc(_Alignof(NodeArena),
+                                                     (number_of_explorers + 1) * sizeof(NodeArena)),
+            .memory_budget=memory_budget,
             .action_index_=0,
-            .root_=construct_node(true, (Action) {}, (is_first_player) ? -1 : 1, NULL, 0),
-            .is_going_to_finish_=false
+            .root_=NULL,
+            .is_going_to_finish_=false,
+            .writers_waiting_=0,
+            .reclaimer_lock=PTHREAD_MUTEX_INITIALIZER,
+            .reclaimer_cond=PTHREAD_COND_INITIALIZER,
+            .root_change_lock=PTHREAD_MUTEX_INITIALIZER,
+            .root_change_cond=PTHREAD_COND_INITIALIZER,
+            .global_epoch_=1,
+            .reclaimer_waiting_=RECLAIMER_RUNNING_,
+            .dfpn_nodes_=0,
+            .collapsing_=ATOMIC_FLAG_INIT,
+            .collapsed_garbage_end_=0,
+            .collapsed_at_ms_=0,
+            .collapsed_subtrees_=0
     };
 
-    SharedResources *res = (SharedResources *) malloc(sizeof(SharedResources));
+    // garbage_queueは64byte境界に揃える必要がある
+    SharedResources *res = (SharedResources *) aligned_alloc(_Alignof(SharedResources), sizeof(SharedResources));
     memcpy(res, &shared_resources, sizeof(SharedResources));
 
+    assert(res->node_arenas != NULL);
+    for (int i = 0; i < number_of_explorers + 1; ++i)
+        res->node_arenas[i] = construct_node_arena(i);
+    res->root_ = construct_node(main_thread_arena_(res), true, NULL_MOVE, (is_first_player) ? -1 : 1, NULL, 0);
+
     return res;
 }
 
 
 void destruct_shared_resources(SharedResources *self) {
 //    assert(self->is_going_to_finish_);
-    pthread_mutex_lock(&self->game_tree_lock);
+    write_lock_game_tree_(self);
     destruct_garbage_queue(&self->garbage_queue);
     destruct_game((Game *) &self->initial_game_state);
-    destruct_node_recursively(self->root_);
-    pthread_mutex_destroy(&self->game_tree_lock);
+    // 全てのノードはアリーナから確保しているので, ゲーム木を辿らずにスラブごと解放する
+    for (int i = 0; i < self->number_of_explorers + 1; ++i)
+        destruct_node_arena(&self->node_arenas[i]);
+    free(self->node_arenas);
+    self->root_ = NULL;
+    if (self->search_engine == SEARCH_ENGINE_HEAP)
+        destruct_transposition_table(&self->transposition_table);
+    else
+        destruct_dfpn_table(&self->dfpn_table);
+    pthread_rwlock_unlock(&self->game_tree_lock);
+    pthread_rwlock_destroy(&self->game_tree_lock);
+    pthread_mutex_destroy(&self->reclaimer_lock);
+    pthread_cond_destroy(&self->reclaimer_cond);
+    pthread_mutex_destroy(&self->root_change_lock);
+    pthread_cond_destroy(&self->root_change_cond);
     free(self);
 }
 
@@ -263,16 +559,33 @@ bool is_going_to_finish(SharedResources *self) {
 }
 
 
-Explorer *construct_explorer(SharedResources *shared_resources) {
+size_t get_game_tree_bytes(SharedResources *self) {
+    // 全てのアリーナから確保したままのノードとヒープのバッファの大きさ[byte] (解放を待つゴミも含む)
+    size_t bytes = 0;
+    for (int i = 0; i < self->number_of_explorers + 1; ++i)
+        bytes += get_arena_live_bytes(&self->node_arenas[i]);
+    return bytes;
+}
+
+
+Explorer *construct_explorer(SharedResources *shared_resources, int explorer_index) {
+    assert(0 <= explorer_index && explorer_index < shared_resources->number_of_explorers);
+
     Explorer *self = (Explorer *) malloc(sizeof(Explorer));
     *self = (Explorer) {
             .shared_resources=shared_resources,
+            .explorer_index=explorer_index,
             .local_action_index=0,
             .local_game=clone(
                     &shared_resources->initial_game_state,
                     shared_resources->initial_game_state.max_turn
             ),
+            .node_arena=&shared_resources->node_arenas[explorer_index],
+            .announced_epoch_=0,
     };
+    // 探索用のGameではHashも手番側から見た盤面も参照しないので, do_actionでのencodeと盤面の反転を省略する
+    set_hash_recording(&self->local_game, false);
+    set_fixed_orientation(&self->local_game, true);
 
     pthread_create(&self->thread_id, NULL, (void *) explore, self);
 
@@ -282,22 +595,19 @@ Explorer *construct_explorer(SharedResources *shared_resources) {
 
 GarbageCollector *construct_garbage_collector(
         SharedResources *shared_resources,
-        const PExplorer p_explorers[NUMBER_OF_THREADS],
+        const PExplorer p_explorers[],
         int number_of_explorers
 ) {
     GarbageCollector *self = (GarbageCollector *) malloc(sizeof(GarbageCollector));
     GarbageCollector garbage_collector = (GarbageCollector) {
             .shared_resources=shared_resources,
+            .p_explorers=(PExplorer *) malloc(number_of_explorers * sizeof(PExplorer)),
             .number_of_explorers=number_of_explorers,
             .is_going_to_finish_=false
     };
 
     memcpy(self, &garbage_collector, sizeof(GarbageCollector));
-
-    for (size_t i = 0; i < NUMBER_OF_THREADS; ++i) {
-        PExplorer *tmp = (PExplorer *) &self->p_explorers[i];
-        *tmp = p_explorers[i];
-    }
+    memcpy(self->p_explorers, p_explorers, number_of_explorers * sizeof(PExplorer));
 
     pthread_create(&self->thread_id, NULL, (void *) collect_garbage, self);
 
@@ -319,104 +629,184 @@ void destruct_garbage_collector(GarbageCollector *self) {
     // garbage_collectorをdestructする前にスレッドが終了する目処が立っている必要あり
     // すなわち、shared_resources.is_going_to_finish = true となっているべき
 
+    // 眠っているGarbageCollectorを起こす (is_going_to_finish_はロックを取る前に書き込む)
+    self->is_going_to_finish_ = true;
+    pthread_mutex_lock(&self->shared_resources->reclaimer_lock);
+    pthread_cond_signal(&self->shared_resources->reclaimer_cond);
+    pthread_mutex_unlock(&self->shared_resources->reclaimer_lock);
+
     pthread_join(self->thread_id, NULL);
+    free(self->p_explorers);
 }
 
 
-// thread-safe
-static void free_nodes_from_leaves_(PNode root) {
-    // root以下のゲーム木を帰りがけ順に解放
+static bool try_advance_epoch_(GarbageCollector *self) {
+    // 全ての探索者が現在のエポックを宣言しているか, ゲーム木を参照していなければエポックを進める
+    SharedResources *const rsc = self->shared_resources;
+    const unsigned long epoch = atomic_load(&rsc->global_epoch_);
 
-    root->parent = NULL;
+    for (int i = 0; i < self->number_of_explorers; ++i) {
+        const unsigned long announced_epoch = atomic_load(&self->p_explorers[i]->announced_epoch_);
+        if (announced_epoch != 0 && announced_epoch != epoch)
+            return false;
+    }
 
-    while (being_edited(root));
+    atomic_store(&rsc->global_epoch_, epoch + 1);
+    return true;
+}
 
-    if (root->is_leaf) {
-        destruct_node(root);
-    } else {
-        for (size_t i = 0; i < root->children.current_size; ++i)
-            free_nodes_from_leaves_(root->children.buf[i]);
-        destruct_node(root);
-    }
+
+static bool is_reclaimable_(GarbageCollector *self, Garbage garbage) {
+    // garbageがどの探索者からも辿れなくなったか否か (全ての探索者が終了していれば常に真)
+    if (self->is_going_to_finish_)
+        return true;
+    return garbage.epoch + 2 <= atomic_load(&self->shared_resources->global_epoch_) || (
+            try_advance_epoch_(self) && garbage.epoch + 2 <= atomic_load(&self->shared_resources->global_epoch_));
+}
+
+
+static void sleep_reclaimer_(GarbageCollector *self, int reason) {
+    // 起こされるまで眠る. 眠る直前に待っている条件を調べ直すので, 起こされ損なうことはない
+    SharedResources *const rsc = self->shared_resources;
+
+    pthread_mutex_lock(&rsc->reclaimer_lock);
+    atomic_store(&rsc->reclaimer_waiting_, reason);
+
+    bool ready;
+    if (self->is_going_to_finish_)
+        ready = true;
+    else if (reason == RECLAIMER_WAITS_GARBAGE_)
+        ready = !is_null_garbage(garbage_queue_front(&rsc->garbage_queue));
+    else
+        ready = try_advance_epoch_(self);
+
+    if (!ready)
+        pthread_cond_wait(&rsc->reclaimer_cond, &rsc->reclaimer_lock);
+
+    atomic_store(&rsc->reclaimer_waiting_, RECLAIMER_RUNNING_);
+    pthread_mutex_unlock(&rsc->reclaimer_lock);
 }
 
 
 void *collect_garbage(GarbageCollector *self) {
+    // キューの先頭のゴミから順に, 外したときのエポックから2つ進んだものを解放する
+    // ゴミがなければ積まれるまで, エポックが進まなければ探索者が宣言し直すまで眠る
     for (;;) {
-        Garbage garbage = garbage_queue_pop(&self->shared_resources->garbage_queue);
+        Garbage garbage = garbage_queue_front(&self->shared_resources->garbage_queue);
 
         if (is_null_garbage(garbage)) {
-            if (self->is_going_to_finish_) {
+            if (self->is_going_to_finish_)
                 pthread_exit(NULL);
-            } else {
-                usleep(50000);  // 50 ms
-                continue;
-            }
+            sleep_reclaimer_(self, RECLAIMER_WAITS_GARBAGE_);
+            continue;
         }
 
-        if (garbage.timing_of_delete != -1) {  // unsignedの値と-1の比較、あまり良くない
-            size_t minimum_action_index = garbage.timing_of_delete;
+        if (!is_reclaimable_(self, garbage)) {
+            sleep_reclaimer_(self, RECLAIMER_WAITS_EXPLORERS_);
+            continue;
+        }
 
-            for (;;) {
-                for (size_t i = 0; i < NUMBER_OF_THREADS; ++i) {
-                    if (self->p_explorers[i]->local_action_index < minimum_action_index)
-                        goto CONTINUE_ACTION_INDEX_CHECK;
-                }
+        garbage_queue_pop(&self->shared_resources->garbage_queue);
+        destruct_node_recursively(garbage.root);
+    }
+}
 
-                /* else */
-                break;
 
-                CONTINUE_ACTION_INDEX_CHECK:;
-            }
+int get_default_number_of_threads(void) {
+    int number_of_threads = get_number_of_available_cpus() - NN_THREADS;
+    if (number_of_threads < 1)
+        number_of_threads = 1;
+    if (number_of_threads > MAX_NUMBER_OF_THREADS)
+        number_of_threads = MAX_NUMBER_OF_THREADS;
+    return number_of_threads;
+}
 
-            destruct_node_recursively(garbage.root);
-        } else {
-            // 葉から解放することでバックプロパゲーションによる不具合を防ぐ
-            // 編集中のノードはバックプロパゲーションが完了するまでbeing_edited == trueであり
-            // free_node_from_leaves_ではその待ち合わせを行うため
-            free_nodes_from_leaves_(garbage.root);
-        }
-    }
+
+size_t get_default_memory_budget_mib(void) {
+    const long pages = sysconf(_SC_PHYS_PAGES), page_size = sysconf(_SC_PAGESIZE);
+    if (pages <= 0 || page_size <= 0)
+        return 1024;  // 物理メモリの大きさが分からなければ1GiBにしておく
+    return (size_t) pages * (size_t) page_size / 2 >> 20;
+}
+
+
+static int explorer_cpu_index_(int explorer_index) {
+    // 探索者を固定するCPUの番号 (使えるCPUのうち何番目か). 先頭のNN_THREADS個はメインスレッドに残しておく
+    const int number_of_cpus = get_number_of_available_cpus();
+    if (number_of_cpus <= NN_THREADS)
+        return explorer_index;
+    return NN_THREADS + explorer_index % (number_of_cpus - NN_THREADS);
 }
 
 
-MultiExplorer create_multi_explorer(const Game *initial_game_state, bool is_first_player, char *nn_filename) {
+MultiExplorer create_multi_explorer(
+        const Game *initial_game_state,
+        bool is_first_player,
+        char *nn_filename,
+        MultiExplorerConfig config
+) {
+    int number_of_explorers = (config.number_of_threads > 0) ? config.number_of_threads
+                                                             : get_default_number_of_threads();
+    if (number_of_explorers > MAX_NUMBER_OF_THREADS)
+        number_of_explorers = MAX_NUMBER_OF_THREADS;
+    if (config.search_engine == SEARCH_ENGINE_DFPN)
+        number_of_explorers = 1;
+    const size_t memory_budget_mib = (config.memory_budget_mib > 0) ? config.memory_budget_mib
+                                                                    : get_default_memory_budget_mib();
+
     MultiExplorer multi_explorer = {
+            .explorers=(Explorer **) malloc(number_of_explorers * sizeof(Explorer *)),
+            .number_of_explorers=number_of_explorers,
             .tmp_actions={},
             .tmp_actions_len=0,
             .neural_network=(NeuralNetwork *) malloc(sizeof(NeuralNetwork)),
             .first_call_flag_=is_first_player
     };
     multi_explorer.get_action = determine_next_action;
-    multi_explorer.shared_resources = construct_shared_resources(initial_game_state, is_first_player);
+    multi_explorer.shared_resources = construct_shared_resources(
+            initial_game_state, is_first_player, config.search_engine, number_of_explorers, memory_budget_mib << 20
+    );
     nn_load_model(multi_explorer.neural_network, nn_filename);
 
-    for (size_t i = 0; i < NUMBER_OF_THREADS; ++i)
-        multi_explorer.explorers[i] = construct_explorer(multi_explorer.shared_resources);
+    // メインスレッド (ニューラルネットワークの探索) と探索者が互いのキャッシュを荒らさないように, 別々のCPUに固定する
+    // 作ったスレッドは作ったスレッドのCPUの割り当てを引き継ぐので, メインスレッドは全てのスレッドを作ってから固定する
+    // (GarbageCollectorは固定せず, 使える全てのCPUで動かす)
+    for (int i = 0; i < number_of_explorers; ++i) {
+        multi_explorer.explorers[i] = construct_explorer(multi_explorer.shared_resources, i);
+        if (config.pins_threads && !pin_thread_to_cpu(multi_explorer.explorers[i]->thread_id, explorer_cpu_index_(i)))
+            debug_print("failed to pin explorer %d.", i);
+    }
+    debug_print("%d explorers on %d cpus%s, game tree budget %zu MiB", number_of_explorers,
+                get_number_of_available_cpus(), (config.pins_threads) ? " (pinned)" : "", memory_budget_mib);
 
     multi_explorer.garbage_collector = construct_garbage_collector(
             multi_explorer.shared_resources,
             multi_explorer.explorers,
-            NUMBER_OF_THREADS
+            multi_explorer.number_of_explorers
     );
 
+    if (config.pins_threads && !pin_thread_to_cpu(pthread_self(), 0))
+        debug_print("failed to pin the main thread.");
+
     return multi_explorer;
 }
 
 
 void destruct_multi_explorer(MultiExplorer *self) {
     self->shared_resources->is_going_to_finish_ = true;
-    for (size_t i = 0; i < NUMBER_OF_THREADS; ++i)
+    notify_root_change_(self->shared_resources);
+    for (int i = 0; i < self->number_of_explorers; ++i)
         destruct_explorer(self->explorers[i]);
 
     self->garbage_collector->is_going_to_finish_ = true;
     destruct_garbage_collector(self->garbage_collector);
 
-    for (int i = 0; i < NUMBER_OF_THREADS; ++i)
+    for (int i = 0; i < self->number_of_explorers; ++i)
         free(self->explorers[i]);
+    free(self->explorers);
     free(self->garbage_collector);
 
-    assert(self->shared_resources->garbage_queue.start_index == self->shared_resources->garbage_queue.end_index);
+    assert(get_garbage_queue_depth(&self->shared_resources->garbage_queue) == 0);
     destruct_shared_resources(self->shared_resources);
 
     nn_free(self->neural_network);
@@ -426,12 +816,14 @@ void destruct_multi_explorer(MultiExplorer *self) {
 
 // thread-safe
 static void change_root_(SharedResources *self, Action previous_action) {
-    pthread_mutex_lock(&self->game_tree_lock);
+    // 根の付け替えは全ての探索者を止めて行う (書き込みロックを取るので, ノードごとのロックは不要)
+    write_lock_game_tree_(self);
 
+    const Move previous_move = action_to_move(previous_action);
     PNode current_root = self->root_;
     PNode next_root = NULL;
     for (size_t i = 0; i < current_root->children.current_size; ++i) {
-        if (action_equal(&previous_action, &current_root->children.buf[i]->action)) {
+        if (previous_move == current_root->children.buf[i]->move) {
             next_root = current_root->children.buf[i];
             heap_delete(&current_root->children, i);
             break;
@@ -439,23 +831,20 @@ static void change_root_(SharedResources *self, Action previous_action) {
     }
 
     if (next_root == NULL) {
-        next_root = construct_node(true, previous_action, current_root->player * (-1), NULL, 0);
+        next_root = construct_node(main_thread_arena_(self), true, previous_move, current_root->player * (-1), NULL, 0);
     } else {
         next_root->parent = NULL;
     }
 
-    bool success = garbage_queue_push(
-            &self->garbage_queue,
-            (Garbage) {.root=current_root, .timing_of_delete=self->action_index_ + 1}
-    );
-    assert(success);
     self->root_ = next_root;
+    retire_(self, current_root);
 
     Action *const action_history = (Action *) self->action_history;
     action_history[self->action_index_] = previous_action;
     ++self->action_index_;
 
-    pthread_mutex_unlock(&self->game_tree_lock);
+    pthread_rwlock_unlock(&self->game_tree_lock);
+    notify_root_change_(self);
 }
 
 
@@ -517,14 +906,37 @@ Action determine_next_action(MultiExplorer *self, const Game *game) {
         self->first_call_flag_ = false;
     }
 
-    // ここで9秒消費される
-    self->tmp_actions_len = get_prioritized_actions(self->neural_network, game, self->tmp_actions);
+    // 王手だけを読む詰み探索で, ゲーム木より先に短い詰みを探す (見つからなければすぐに諦める)
+    const MateResult mate = solve_mate(game, (MateLimits) {
+            .max_depth=ROOT_MATE_DEPTH,
+            .max_nodes=ROOT_MATE_NODES,
+            .max_seconds=ROOT_MATE_SECONDS
+    });
 
-    debug_print("garbage count: %ld, total released garbage: %ld",
-                rsc->garbage_queue.end_index - rsc->garbage_queue.start_index,
-                rsc->garbage_queue.start_index);
+    // ここで9秒消費される (詰み探索に使いうる時間を引いて, 1手の思考時間MAX_TIMEに収める)
+    // 詰みが見つかっていれば, その指手を指すのでニューラルネットワークの探索は省く
+    if (mate.status != MATE_FOUND)
+        self->tmp_actions_len = get_prioritized_actions(self->neural_network, game, self->tmp_actions,
+                                                        MAX_TIME * 0.95 - ROOT_MATE_SECONDS);
 
-    pthread_mutex_lock(&rsc->game_tree_lock);
+    debug_print("garbage count: %zu (max %zu), total released garbage: %zu",
+                get_garbage_queue_depth(&rsc->garbage_queue),
+                get_garbage_queue_max_depth(&rsc->garbage_queue),
+                get_garbage_queue_popped(&rsc->garbage_queue));
+
+    debug_print("lock contention count: %lu", get_lock_contention_count());
+
+    size_t arena_bytes = 0;
+    for (int i = 0; i < rsc->number_of_explorers + 1; ++i)
+        arena_bytes += get_arena_bytes(&rsc->node_arenas[i]);
+    debug_print("node arena size: %zu MiB (live %zu MiB, budget %zu MiB), collapsed subtrees: %lu",
+                arena_bytes >> 20, get_game_tree_bytes(rsc) >> 20, rsc->memory_budget >> 20,
+                atomic_load(&rsc->collapsed_subtrees_));
+
+    if (rsc->search_engine != SEARCH_ENGINE_HEAP)
+        debug_print("df-pn searched nodes: %lld", atomic_load(&rsc->dfpn_nodes_));
+
+    write_lock_game_tree_(rsc);
 
     debug_print("total number of searched nodes: %ld", count_node_(rsc->root_));
     int min_depth = INF_DEPTH, max_depth = 0;
@@ -536,16 +948,40 @@ Action determine_next_action(MultiExplorer *self, const Game *game) {
     for (size_t i = 0; i < rsc->root_->children.current_size; ++i) {
         if (rsc->root_->children.buf[i]->value_for_heap == INF_DEPTH) {
             debug_print("CONGRATULATION! MultiExplorer will win!");
-            next_action = rsc->root_->children.buf[i]->action;
+            next_action = move_to_action(rsc->root_->children.buf[i]->move);
+            goto NEXT_ACTION_FOUND;
+        }
+    }
+
+    /* else */
+    // df-pnの証明は千日手が起こりえない局面を前提にしているので, 千日手が起こりうる局面では使わない
+    // 手数の上限までに証明木の末端に届かない証明 (前の手番に見つけた長い証明など) も使わない
+    if (rsc->search_engine != SEARCH_ENGINE_HEAP && !has_repetition_candidates(game)) {
+        uint32_t pn, dn;
+        Move dfpn_move;
+        int proof_length;
+        if (dfpn_probe(&rsc->dfpn_table, get_zobrist_key(game), &pn, &dn, &dfpn_move, &proof_length) && pn == 0 &&
+            game->turn + proof_length <= game->max_turn &&
+            is_possible_action_with_tfr(game, move_to_action(dfpn_move))) {
+            debug_print("CONGRATULATION! df-pn proved that MultiExplorer will win!");
+            next_action = move_to_action(dfpn_move);
             goto NEXT_ACTION_FOUND;
         }
     }
 
+    /* else */
+    if (mate.status == MATE_FOUND) {
+        debug_print("mate in %d found by the mate solver (%lld nodes)", mate.len_line, mate.nodes);
+        next_action = move_to_action(mate.line[0]);
+        goto NEXT_ACTION_FOUND;
+    }
+
     /* else */
     for (size_t i = 0; i < self->tmp_actions_len; ++i) {
         next_action = self->tmp_actions[i];
+        const Move next_move = action_to_move(next_action);
         for (size_t j = 0; j < rsc->root_->children.current_size; ++j)
-            if (action_equal(&next_action, &rsc->root_->children.buf[j]->action))
+            if (next_move == rsc->root_->children.buf[j]->move)
                 goto NEXT_ACTION_FOUND;
     }
 
@@ -553,7 +989,7 @@ Action determine_next_action(MultiExplorer *self, const Game *game) {
     next_action = self->tmp_actions[0];
 
     NEXT_ACTION_FOUND:
-    pthread_mutex_unlock(&rsc->game_tree_lock);
+    pthread_rwlock_unlock(&rsc->game_tree_lock);
 
     change_root_(rsc, next_action);
 
@@ -589,7 +1025,7 @@ char *show_children(PNode node) {
         if (i % 10 == 0 && i)
             counter += sprintf(ret_buf + counter, "\n");
         char buf[32];
-        action_to_string(nodes[i]->action, buf);
+        action_to_string(move_to_action(nodes[i]->move), buf);
         counter += sprintf(ret_buf + counter,
                            "[%ld]%s:%d, ",
                            nodes[i]->index_in_parents_heap_,
@@ -655,53 +1091,78 @@ int calc_value_for_heap_(PNode node) {
 }
 
 
-PNode get_next_node_unsafe_(Explorer *self, PNode current_node) {
-    PNode ret;
+static void value_for_heap_propagation_(PNode node);
 
-    if (current_node->is_leaf) {
-        if (!being_edited(current_node) && current_node->value_for_heap != INF_DEPTH) {
-            // at this point, being_edited(current_node) becomes true.
-            current_node->value_for_heap += DEPTH_STRIDE;
-            ret = current_node;
-        } else {  // current_node is now being edited.
-            ret = NULL;
-        }
-    } else {
+
+static bool claim_leaf_(PNode leaf) {
+    // 葉leafを編集中にする (leafのvalue_for_heapを保護するロックを取った状態で呼ぶ)
+    // 畳まれた葉は畳む前の値のまま編集中にし, 普通の葉と同じくDEPTH_STRIDE手だけ展開し直す
+    if (being_edited(leaf) || leaf->value_for_heap == INF_DEPTH)  // leaf is now being edited.
+        return false;
+
+    // at this point, being_edited(leaf) becomes true.
+    leaf->is_collapsed_ = false;
+    leaf->value_for_heap += DEPTH_STRIDE;
+    return true;
+}
+
+
+PNode get_next_node_unsafe_(Explorer *self, PNode root) {
+    // 根から各ノードのヒープの先頭を辿って葉を選び, 編集中にして返す
+    // ノードのロックを親→子の順に1つずつ付け替えながら降りるので, 別の部分木を辿る探索者とは待ち合わせない
+    // ゲーム木の読み込みロックを取った状態で呼ぶ
+
+    lock_node(root);
+    if (is_leaf_(root)) {
+        PNode ret = (claim_leaf_(root)) ? root : NULL;
+        unlock_node(root);
+        return ret;
+    }
+
+    PNode current_node = root;
+    int depth = 0;
+    for (;;) {
         assert(current_node->children.current_size != 0);
         PNode child = current_node->children.buf[0];
-        int old_value_for_heap = child->value_for_heap;
 
-        do_action(&self->local_game, child->action);
-        ret = get_next_node_unsafe_(self, child);
+        if (is_leaf_(child)) {
+            if (!claim_leaf_(child)) {
+                unlock_node(current_node);
+                for (int i = 0; i < depth; ++i)
+                    undo_action(&self->local_game);
+                return NULL;
+            }
 
-        if (ret == NULL) {
-            undo_action(&self->local_game);
-        } else {
             assert(get_index_in_parents_heap(child) == 0);
-            int new_value_for_heap = child->value_for_heap;
-            if (old_value_for_heap != new_value_for_heap) {
-                heap_replace(&current_node->children, 0, child->value_for_heap);
-                current_node->value_for_heap = calc_value_for_heap_(current_node);
-            }
+            heap_replace(&current_node->children, 0, child->value_for_heap);
+            unlock_node(current_node);
+
+            do_move(&self->local_game, child->move);
+            value_for_heap_propagation_(current_node);
+            return child;
         }
-    }
 
-    return ret;
+        lock_node(child);
+        unlock_node(current_node);
+        do_move(&self->local_game, child->move);
+        ++depth;
+        current_node = child;
+    }
 }
 
 
 PNode get_next_node_(Explorer *self) {
-    pthread_mutex_lock(&self->shared_resources->game_tree_lock);
+    read_lock_game_tree_(self->shared_resources);
 
     // shared_resources.root_の不整合を防ぐ
     if (self->local_action_index != get_action_index(self->shared_resources)) {
-        pthread_mutex_unlock(&self->shared_resources->game_tree_lock);
+        pthread_rwlock_unlock(&self->shared_resources->game_tree_lock);
         return NULL;
     }
 
     PNode ret = get_next_node_unsafe_(self, get_game_tree_root(self->shared_resources));
 
-    pthread_mutex_unlock(&self->shared_resources->game_tree_lock);
+    pthread_rwlock_unlock(&self->shared_resources->game_tree_lock);
     return ret;
 }
 
@@ -724,22 +1185,64 @@ bool update_action_index_(Explorer *self) {
 }
 
 
-int expand_(PNode leaf, const Game *game, GarbageQueue *garbage_queue, int depth) {
+static int settle_proven_leaf_(NodeArena *arena, PNode leaf, int current_player, bool wins, Move winning_move) {
+    // 手番側current_playerの勝敗が置換表で分かっている局面leafに, 勝敗を表す子を1つだけ付ける
+    // 詰みの一手の場合と同じ形にするので, 戻り値もexpand_と同じ意味を持つ
+
+    PNode child = construct_node(arena, true, (wins) ? winning_move : NULL_MOVE, current_player, leaf, 0);
+    leaf->children = construct_heap(arena, 1);
+    heap_push(&leaf->children, child);
+
+    if (wins == (current_player == 1)) {  // 自分の勝ち
+        child->value_for_heap = INF_DEPTH;
+        return 0;  // normal state
+    } else {  // 相手の勝ち
+        return 1;  // delete state
+    }
+}
+
+
+int expand_(PNode leaf, const Game *game, SharedResources *rsc, NodeArena *arena, int depth, bool *depends_on_history) {
     // leaf.is_leafは変化させないことに注意
     // leaf.value_for_heapは変化させないことに注意 (後で調整の必要あり)
+    // 展開した部分木で千日手が起こりえた (勝敗が履歴に依存しうる) 場合, *depends_on_historyを真にする
+    // 新しいノードは探索者のアリーナarenaから確保する
 
     assert(depth > 0);
     const int current_player = leaf->player * (-1);
+    const uint64_t key = get_zobrist_key(game);
+    bool subtree_depends_on_history = has_repetition_candidates(game);
+
+    // 勝敗が証明済みの局面は置換表から結果を得て展開しない
+    // 置換表には履歴に依存しない結果しか記録しないが, この局面で千日手が起こりうる場合は使わない
+    if (!subtree_depends_on_history) {
+        Move tt_move;
+        int tt_depth;
+        TTResult result = tt_probe(&rsc->transposition_table, key, &tt_move, &tt_depth);
+        if (result != TT_UNKNOWN)
+            return settle_proven_leaf_(arena, leaf, current_player, result == TT_WIN, tt_move);
+    } else {
+        *depends_on_history = true;
+    }
 
-    Action all_actions[LEN_ACTIONS];
-    const int action_len = get_perfectly_useful_actions_with_tfr(game, all_actions);
+    Move all_moves[LEN_ACTIONS];
+    const int action_len = get_perfectly_useful_moves_with_tfr(game, all_moves);
     assert(action_len != 0);
 
     if (action_len == -1) {  // 詰みの一手の場合
-        PNode child = construct_node(true, all_actions[0], current_player, leaf, 0);
-        leaf->children = construct_heap(1);
+        PNode child = construct_node(arena, true, all_moves[0], current_player, leaf, 0);
+        leaf->children = construct_heap(arena, 1);
         heap_push(&leaf->children, child);
 
+        // 詰ませた後の局面で千日手が起こりうるなら, 相手の応手が履歴によって制限されている可能性がある
+        do_move((Game *) game, all_moves[0]);
+        subtree_depends_on_history |= has_repetition_candidates(game);
+        undo_action((Game *) game);
+        if (subtree_depends_on_history)
+            *depends_on_history = true;
+        else
+            tt_store(&rsc->transposition_table, key, TT_WIN, all_moves[0], depth);
+
         if (current_player == 1) {  // 自分の勝ち
             child->value_for_heap = INF_DEPTH;
             return 0;  // normal state
@@ -752,12 +1255,13 @@ int expand_(PNode leaf, const Game *game, GarbageQueue *garbage_queue, int depth
         PNode children[LEN_ACTIONS];
         int child_len = 0;
         int ret_code = 0;
+        Move refutation = NULL_MOVE;  // 相手の手番で, 相手の勝ちが証明された指手
 
         for (int i = 0; i < action_len; ++i) {
-            PNode child = construct_node(true, all_actions[i], current_player, leaf, 0);
+            PNode child = construct_node(arena, true, all_moves[i], current_player, leaf, 0);
 
-            do_action((Game *) game, all_actions[i]);
-            int status = expand_(child, game, garbage_queue, depth - 1);
+            do_move((Game *) game, all_moves[i]);
+            int status = expand_(child, game, rsc, arena, depth - 1, &subtree_depends_on_history);
             undo_action((Game *) game);
 
             child->is_leaf = false;
@@ -771,6 +1275,7 @@ int expand_(PNode leaf, const Game *game, GarbageQueue *garbage_queue, int depth
 
                 if (current_player == -1) {  // 相手の手番なら全削除
                     ret_code = 1;
+                    refutation = all_moves[i];
                     break;
                 } else {  // 自分の手番なら必要最小限の削除
                     assert(current_player == 1);
@@ -779,85 +1284,226 @@ int expand_(PNode leaf, const Game *game, GarbageQueue *garbage_queue, int depth
                         break;
                     } else {
                         --child_len;
-                        garbage_queue_push(
-                                garbage_queue,
-                                (Garbage) {.timing_of_delete=-1, .root=child}
-                        );
+                        retire_(rsc, child);
                     }
                 }
             }
         }
 
         if (child_len == 0) {
-            children[child_len++] = construct_node(true, (Action) {}, current_player, leaf, 0);
+            children[child_len++] = construct_node(arena, true, NULL_MOVE, current_player, leaf, 0);
             ret_code = 1;
         }
 
-        leaf->children = construct_heap(child_len);
+        // 勝敗が証明できた場合は, 他のスレッドや別の手順で同じ局面に来たときのために置換表に記録する
+        if (subtree_depends_on_history) {
+            *depends_on_history = true;
+        } else if (ret_code == 1) {
+            if (current_player == -1)
+                tt_store(&rsc->transposition_table, key, TT_WIN, refutation, depth);
+            else
+                tt_store(&rsc->transposition_table, key, TT_LOSS, NULL_MOVE, depth);
+        } else {
+            int len_proven = 0;
+            Move proven_move = NULL_MOVE;
+            for (int i = 0; i < child_len; ++i) {
+                if (children[i]->value_for_heap == INF_DEPTH) {
+                    ++len_proven;
+                    proven_move = children[i]->move;
+                }
+            }
+            if (current_player == 1 && len_proven > 0)
+                tt_store(&rsc->transposition_table, key, TT_WIN, proven_move, depth);
+            else if (current_player == -1 && len_proven == child_len)
+                tt_store(&rsc->transposition_table, key, TT_LOSS, NULL_MOVE, depth);
+        }
+
+        leaf->children = construct_heap(arena, child_len);
         for (int i = 0; i < child_len; ++i)
             heap_push(&leaf->children, children[i]);
 
         return ret_code;
     } else {  // depth == 1
-        leaf->children = construct_heap(action_len);
+        leaf->children = construct_heap(arena, action_len);
         for (int i = 0; i < action_len; ++i)
-            leaf->children.buf[i] = construct_node(true, all_actions[i], current_player, leaf, i);
+            leaf->children.buf[i] = construct_node(arena, true, all_moves[i], current_player, leaf, i);
         leaf->children.current_size = action_len;
         return 0;  // normal state
     }
 }
 
 
-// thread-unsafe
-void value_for_heap_propagation_(PNode node) {
-    PNode parent = node->parent;
-    if (parent == NULL)
-        return;
+// thread-safe (ゲーム木の読み込みロックを取った状態で呼ぶ)
+static void value_for_heap_propagation_(PNode node) {
+    // nodeの子が変化したときに, nodeから根に向かってvalue_for_heapを更新する
+    // 親→子の順に2つのノードをロックして1段ずつ更新し, 値が変わらなくなった時点で止める
 
-    heap_replace(&parent->children, get_index_in_parents_heap(node), calc_value_for_heap_(node));
+    for (;;) {
+        PNode parent = node->parent;
+        if (parent == NULL) {
+            lock_node(node);
+            node->value_for_heap = calc_value_for_heap_(node);
+            unlock_node(node);
+            return;
+        }
 
-    int new_value_for_heap = calc_value_for_heap_(parent);
-    if (parent->value_for_heap != new_value_for_heap)
-        value_for_heap_propagation_(parent);
+        lock_node(parent);
+        lock_node(node);
+
+        bool changed = false;
+        if (node->parent == parent) {  // ロックを取るまでに削除されていなければ
+            int new_value_for_heap = calc_value_for_heap_(node);
+            changed = (node->value_for_heap != new_value_for_heap);
+            heap_replace(&parent->children, get_index_in_parents_heap(node), new_value_for_heap);
+        }
+
+        unlock_node(node);
+        unlock_node(parent);
+
+        if (!changed)
+            return;
+        node = parent;
+    }
 }
 
 
-// thread-unsafe
+// thread-safe (ゲーム木の読み込みロックを取った状態で呼ぶ)
 int delete_propagation_(SharedResources *rsc, PNode node) {
     // 戻り値は、既に削除されているノードを削除しようとした場合1、
     // 削除に成功した場合0、現在のルートノードを削除しようとした場合-1である
     // -1が返った場合必敗状態にある
 
-    if (node->parent == NULL) {
-        if (node == rsc->root_) {
-            return -1;  // ルートノードを削除しようとした
-        } else {
-            return 1;  // 既に削除されているノードを削除しようとした
+    for (;;) {
+        PNode parent = node->parent;
+        if (parent == NULL) {
+            if (node == rsc->root_) {
+                return -1;  // ルートノードを削除しようとした
+            } else {
+                return 1;  // 既に削除されているノードを削除しようとした
+            }
+        }
+
+        if (node->player != 1) {
+            node = parent;
+            continue;
         }
+
+        lock_node(parent);
+        lock_node(node);
+
+        if (node->parent != parent) {  // ロックを取るまでに他の探索者が削除した
+            unlock_node(node);
+            unlock_node(parent);
+            return 1;
+        }
+        if (parent->children.current_size == 1) {
+            unlock_node(node);
+            unlock_node(parent);
+            node = parent;
+            continue;
+        }
+
+        heap_delete(&parent->children, node->index_in_parents_heap_);
+        node->parent = NULL;
+        unlock_node(node);
+        unlock_node(parent);
+
+        value_for_heap_propagation_(parent);
+        retire_(rsc, node);
+        return 0;
     }
+}
 
-    if (node->player == 1) {
-        if (node->parent->children.current_size == 1) {
-            return delete_propagation_(rsc, node->parent);
-        } else {
-            heap_delete(&node->parent->children, node->index_in_parents_heap_);
-            value_for_heap_propagation_(node->parent);
-            node->parent = NULL;
-            garbage_queue_push(&rsc->garbage_queue, (Garbage) {node, -1});
-            return 0;
+
+static PNode coldest_child_(PNode node) {
+    // nodeの子のうち, value_for_heapが最大の展開済みで勝ちの決まっていない子 (なければNULL). nodeのロックを取った状態で呼ぶ
+    // 勝ちが決まった部分木は, 根での指手の選択に使うので畳まない
+    if (is_leaf_(node))
+        return NULL;
+
+    PNode coldest = NULL;
+    for (size_t i = 0; i < node->children.current_size; ++i) {
+        PNode child = node->children.buf[i];
+        if (is_leaf_(child) || child->value_for_heap == INF_DEPTH)
+            continue;
+        if (coldest == NULL || child->value_for_heap > coldest->value_for_heap)
+            coldest = child;
+    }
+    return coldest;
+}
+
+
+static size_t estimate_subtree_bytes_(PNode root, size_t limit) {
+    // rootの部分木のノードとヒープのバッファの大きさの目安[byte]. limitを超えた時点で数えるのをやめる
+    // rootのロックを取った状態で呼ぶ. 子のヒープは子のロックを取ってから読む (祖先→子孫の順なのでデッドロックしない)
+    if (is_leaf_(root))
+        return sizeof(Node);
+
+    size_t bytes = sizeof(Node) + root->children.max_size * sizeof(PNode);
+    for (size_t i = 0; i < root->children.current_size && bytes < limit; ++i) {
+        PNode child = root->children.buf[i];
+        lock_node(child);
+        bytes += estimate_subtree_bytes_(child, limit - bytes);
+        unlock_node(child);
+    }
+    return bytes;
+}
+
+
+// thread-safe (ゲーム木の読み込みロックを取った状態で呼ぶ)
+static bool collapse_coldest_subtree_(SharedResources *rsc, size_t target_bytes) {
+    /*
+    最も有望でない (value_for_heapが最大の) 展開済みの部分木の子を全て捨て, その根を葉に戻す.
+    根からcoldest_child_を辿り, 部分木がtarget_bytesの2倍より小さくなった段で畳む (捨て過ぎないようにする).
+    畳んだノードは畳む前のvalue_for_heapを残すので, ヒープ中の順位は変わらず, 選ばれたときに展開し直される.
+    捨てた子は親をNULLにしてからゴミとして積むので, その中を探索中の探索者の伝播は畳んだノードで止まる.
+    部分木を畳めなかった場合は偽を返す.
+    */
+    PNode parent = rsc->root_;
+    lock_node(parent);
+    PNode coldest;
+    for (;;) {
+        coldest = coldest_child_(parent);
+        if (coldest == NULL) {
+            unlock_node(parent);
+            return false;
         }
-    } else {
-        return delete_propagation_(rsc, node->parent);
+
+        lock_node(coldest);
+        if (estimate_subtree_bytes_(coldest, 2 * target_bytes) < 2 * target_bytes || coldest_child_(coldest) == NULL)
+            break;
+        unlock_node(parent);
+        parent = coldest;
     }
+
+    // 親のロックも取っているので, 親のヒープを辿ってcoldestに入ろうとしている探索者はいない
+    Heap children = coldest->children;
+    for (size_t i = 0; i < children.current_size; ++i)
+        children.buf[i]->parent = NULL;
+    coldest->children = (Heap) {};
+    coldest->is_collapsed_ = true;
+    __atomic_store_n(&coldest->is_leaf, true, __ATOMIC_RELEASE);
+    unlock_node(coldest);
+    unlock_node(parent);
+
+    for (size_t i = 0; i < children.current_size; ++i)
+        retire_(rsc, children.buf[i]);
+    destruct_heap(&children);
+    atomic_fetch_add(&rsc->collapsed_subtrees_, 1);
+    return true;
 }
 
 
 void stun_and_wait_opponents_mistake_(Explorer *self, PNode problematic_leaf) {
+    // problematic_leafの祖先を辿るので, スタンしている間はエポックを宣言し直さない (その間ゴミは解放されない)
     size_t current_action_index = self->local_action_index;
 
     while (!is_going_to_finish(self->shared_resources)) {
-        while (current_action_index == get_action_index(self->shared_resources))
+        while (current_action_index == get_action_index(self->shared_resources)) {
+            if (is_going_to_finish(self->shared_resources))
+                return;
             usleep(50000);  // 50 ms
+        }
 
         PNode new_root = get_game_tree_root(self->shared_resources);
         for (PNode node = problematic_leaf; node; node = node->parent) {
@@ -874,8 +1520,130 @@ void stun_and_wait_opponents_mistake_(Explorer *self, PNode problematic_leaf) {
 }
 
 
+static void announce_quiescent_point_(Explorer *self) {
+    // ゲーム木のノードへのポインタを1つも持っていない時点で呼び, 現在のエポックを宣言し直す
+    SharedResources *const rsc = self->shared_resources;
+    const unsigned long epoch = atomic_load(&rsc->global_epoch_);
+
+    if (atomic_load_explicit(&self->announced_epoch_, memory_order_relaxed) != epoch) {
+        atomic_store(&self->announced_epoch_, epoch);
+        wake_reclaimer_(rsc, RECLAIMER_WAITS_EXPLORERS_);
+    }
+}
+
+
+static void wait_for_garbage_collector_(Explorer *self) {
+    // ゴミの解放が追いつかずキューが長くなりすぎたら, 半分に減るまで探索を止める
+    // 待つ間はゲーム木を参照しないと宣言するので, この探索者がエポックを止めることはない
+    SharedResources *const rsc = self->shared_resources;
+    if (get_garbage_queue_depth(&rsc->garbage_queue) < GARBAGE_QUEUE_LIMIT)
+        return;
+
+    atomic_store(&self->announced_epoch_, 0);
+    wake_reclaimer_(rsc, RECLAIMER_WAITS_EXPLORERS_);
+
+    while (get_garbage_queue_depth(&rsc->garbage_queue) >= GARBAGE_QUEUE_LIMIT / 2 && !is_going_to_finish(rsc))
+        usleep(1000);  // 1 ms
+}
+
+
+static long long monotonic_ms_(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+static void enforce_memory_budget_(Explorer *self) {
+    /*
+    ゲーム木がメモリの上限を超えたら, 上限の1/MEMORY_BUDGET_SLACKだけ下回るまで探索を止めて部分木を畳む.
+    畳むのは一度に1つの探索者だけで, 前に畳んだ部分木が解放されてから次を畳む (解放を待たずに畳み過ぎない).
+    待つ間はゲーム木を参照しないと宣言するので, この探索者がエポックを止めることはない.
+    ただし, 畳める部分木がない場合や, 前に畳んだ部分木がMEMORY_BUDGET_WAIT_MSを過ぎても解放されない場合
+    (スタン中の探索者がエポックを止めている場合など) は, 待ち続けずに上限を超えたまま探索を続ける.
+    */
+    SharedResources *const rsc = self->shared_resources;
+    if (get_game_tree_bytes(rsc) < rsc->memory_budget)
+        return;
+
+    const size_t low_watermark = rsc->memory_budget - rsc->memory_budget / MEMORY_BUDGET_SLACK;
+    size_t bytes;
+    while ((bytes = get_game_tree_bytes(rsc)) >= low_watermark && !is_going_to_finish(rsc)) {
+        const bool is_released = get_garbage_queue_popped(&rsc->garbage_queue) >= atomic_load(&rsc->collapsed_garbage_end_);
+        if (!is_released) {
+            if (monotonic_ms_() - atomic_load(&rsc->collapsed_at_ms_) >= MEMORY_BUDGET_WAIT_MS)
+                return;
+        } else if (!atomic_flag_test_and_set(&rsc->collapsing_)) {
+            announce_quiescent_point_(self);
+            read_lock_game_tree_(rsc);
+            const bool collapsed = collapse_coldest_subtree_(rsc, bytes - low_watermark);
+            pthread_rwlock_unlock(&rsc->game_tree_lock);
+            if (collapsed) {
+                atomic_store(&rsc->collapsed_garbage_end_, get_garbage_queue_pushed(&rsc->garbage_queue));
+                atomic_store(&rsc->collapsed_at_ms_, monotonic_ms_());
+            }
+            atomic_flag_clear(&rsc->collapsing_);
+            if (!collapsed)
+                return;
+        }
+
+        atomic_store(&self->announced_epoch_, 0);
+        wake_reclaimer_(rsc, RECLAIMER_WAITS_EXPLORERS_);
+        usleep(1000);  // 1 ms
+    }
+}
+
+
+static bool is_root_changed_(void *arg) {
+    // df-pnの打ち切りの条件: 根が付け替えられたか, 終了が要求されたか
+    Explorer *self = (Explorer *) arg;
+    return is_going_to_finish(self->shared_resources) ||
+           self->local_action_index != get_action_index(self->shared_resources);
+}
+
+
+static void explore_by_dfpn_(Explorer *self) {
+    // 根の局面から, 勝ちが証明か反証されるまでdf-pnで探索する. 根が付け替えられたら新しい根から探索し直す
+    // 証明数・反証数は置換表に残るので, 探索し直しても前の根で探索した部分は無駄にならない
+    SharedResources *const rsc = self->shared_resources;
+
+    // ゲーム木のノードを参照しないので, エポックを止めないようにゲーム木を参照していないと宣言しておく
+    atomic_store(&self->announced_epoch_, 0);
+    wake_reclaimer_(rsc, RECLAIMER_WAITS_EXPLORERS_);
+
+    while (!is_going_to_finish(rsc)) {
+        update_action_index_(self);
+
+        const DfpnResult result = solve_dfpn(&rsc->dfpn_table, &self->local_game, (DfpnConfig) {
+                .attacker_is_first=rsc->is_first_player,
+                .thread_index=self->explorer_index,
+                .should_stop=is_root_changed_,
+                .stop_arg=self
+        });
+        atomic_fetch_add(&rsc->dfpn_nodes_, result.nodes);
+
+        // 勝敗が決まった (またはこれ以上は示せない) ので, 根が付け替えられるまで眠る
+        // 条件はロックを取ってから調べ直すので, notify_root_change_に起こされ損なうことはない
+        if (!result.stopped) {
+            pthread_mutex_lock(&rsc->root_change_lock);
+            while (!is_root_changed_(self))
+                pthread_cond_wait(&rsc->root_change_cond, &rsc->root_change_lock);
+            pthread_mutex_unlock(&rsc->root_change_lock);
+        }
+    }
+}
+
+
 void *explore(Explorer *self) {
+    if (self->shared_resources->search_engine != SEARCH_ENGINE_HEAP) {
+        explore_by_dfpn_(self);
+        pthread_exit(NULL);
+    }
+
     while (!is_going_to_finish(self->shared_resources)) {
+        wait_for_garbage_collector_(self);
+        enforce_memory_budget_(self);
+        announce_quiescent_point_(self);
         update_action_index_(self);
 
         int saved_id = save(&self->local_game);
@@ -886,8 +1654,9 @@ void *explore(Explorer *self) {
             continue;
         }
 
+        bool depends_on_history = false;
         int ret_code = expand_(
-                leaf, &self->local_game, &self->shared_resources->garbage_queue, DEPTH_STRIDE
+                leaf, &self->local_game, self->shared_resources, self->node_arena, DEPTH_STRIDE, &depends_on_history
         );
 
         load(&self->local_game, saved_id);
@@ -898,9 +1667,9 @@ void *explore(Explorer *self) {
 
         if (ret_code == 1) {
             // 削除のバックプロパゲーションが必要
-            pthread_mutex_lock(&self->shared_resources->game_tree_lock);
+            read_lock_game_tree_(self->shared_resources);
             int status = delete_propagation_(self->shared_resources, leaf);
-            pthread_mutex_unlock(&self->shared_resources->game_tree_lock);
+            pthread_rwlock_unlock(&self->shared_resources->game_tree_lock);
 
             // 必敗状態であり、これ以上の探索は無駄である
             // よって、スタンしつつ相手がミスするのを待つ
@@ -911,17 +1680,19 @@ void *explore(Explorer *self) {
                 debug_print("thread %ld returned from stun.", self->thread_id);
             }
         } else if (leaf->value_for_heap != calc_value_for_heap_(leaf)) {
-            pthread_mutex_lock(&self->shared_resources->game_tree_lock);
+            read_lock_game_tree_(self->shared_resources);
             value_for_heap_propagation_(leaf);
-            pthread_mutex_unlock(&self->shared_resources->game_tree_lock);
+            pthread_rwlock_unlock(&self->shared_resources->game_tree_lock);
         }
 
         // at this point, being_edited(leaf) becomes false
-        leaf->is_leaf = false;
+        // 他の探索者がis_leafの偽を見たときにはexpand_で作ったchildrenが見えるようにする
+        __atomic_store_n(&leaf->is_leaf, false, __ATOMIC_RELEASE);
     }
 
     // for garbage_collector not to be blocked
-    update_action_index_(self);
+    atomic_store(&self->announced_epoch_, 0);
+    wake_reclaimer_(self->shared_resources, RECLAIMER_WAITS_EXPLORERS_);
 
     pthread_exit(NULL);
 }
\ No newline at end of file
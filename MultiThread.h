@@ -3,13 +3,40 @@
 
 
 #include <pthread.h>
+#include <stdatomic.h>
 #include "Game.h"
+#include "NodeArena.h"
+#include "DfpnTable.h"
+#include "TranspositionTable.h"
 #include "neural_network/neural_network.h"
 
-#define NUMBER_OF_THREADS      8         // スレッド数
-#define MAX_GARBAGE_QUEUE_SIZE 1000000   // ゴミ(解放待ちのポインタ)を格納するキューのサイズ
+#define MAX_NUMBER_OF_THREADS  63        // 探索者のスレッドの数の上限 (アリーナを探索者ごとに1つとメインスレッド用に1つ使う)
+#define NN_THREADS             1         // ニューラルネットワークの探索に使うスレッドの数 (メインスレッド)
+#define GARBAGE_CHUNK_SIZE     4096      // ゴミ(解放待ちのポインタ)を格納するキューを伸ばす単位
+#define GARBAGE_QUEUE_LIMIT    1000000   // キューの長さがこれを超えると, 探索者は解放が追いつくまで探索を止める
 #define INF_DEPTH              10000000  // ゲーム木の深さが無限であることを表す値
 #define DEPTH_STRIDE           3         // 1つのスレッドが一度に探索するゲーム木の深さ
+#define ROOT_MATE_DEPTH        9         // 毎手番の詰み探索で読む手数の上限
+#define ROOT_MATE_NODES        200000    // 毎手番の詰み探索のノード数の上限
+#define ROOT_MATE_SECONDS      0.5       // 毎手番の詰み探索の時間の上限[秒]
+#define TRANSPOSITION_BITS     22        // 置換表のエントリ数の2を底とする対数 (1エントリ16byte)
+#define DFPN_TABLE_BITS        22        // df-pnの置換表のエントリ数の2を底とする対数 (1エントリ16byte)
+#define MEMORY_BUDGET_SLACK    8         // ゲーム木がメモリの上限を超えたら, 上限の1/MEMORY_BUDGET_SLACKだけ下回るまで部分木を畳む
+#define MEMORY_BUDGET_WAIT_MS  100       // 畳んだ部分木がこの時間[ms]を過ぎても解放されなければ, 上限を超えたまま探索を続ける
+
+
+typedef enum {                // 探索者がゲーム木をどう探索するか (起動時に選ぶ)
+    SEARCH_ENGINE_HEAP,       // ヒープで選んだ葉をDEPTH_STRIDE手ずつ展開し, ゲーム木をメモリに持つ
+    SEARCH_ENGINE_DFPN,       // 1つの探索者がdf-pnで根の勝ちを証明する (ゲーム木は持たず, 置換表だけを使う)
+    SEARCH_ENGINE_DFPN_SHARED // 全ての探索者がdf-pnの置換表を共有して, 同じ根を並列に証明する
+} SearchEngine;
+
+typedef struct {                  // MultiExplorerの設定 (起動時に決める)
+    SearchEngine search_engine;   // 探索者が使う探索の方法
+    int number_of_threads;        // 探索者のスレッドの数 (0以下ならget_default_number_of_threads()にする)
+    bool pins_threads;            // メインスレッドと探索者をそれぞれ別のCPUに固定するか否か
+    size_t memory_budget_mib;     // ゲーム木のノードに使うメモリの上限[MiB] (0ならget_default_memory_budget_mib()にする)
+} MultiExplorerConfig;
 
 
 typedef struct tagNode Node, *PNode;
@@ -24,7 +51,7 @@ typedef struct {
     size_t current_size;  // ヒープの現在の要素数
 } Heap;
 
-Heap construct_heap(size_t max_size);
+Heap construct_heap(NodeArena *arena, size_t max_size);
 
 void destruct_heap(Heap *heap);
 
@@ -37,11 +64,13 @@ void heap_push(Heap *heap, PNode node);
 
 /**
  * ゲーム木のノードを表すクラス & そのメソッド
+ * childrenと子ノードのvalue_for_heap, index_in_parents_heap_はそのノードのlock_で保護する (根のvalue_for_heapは根のlock_)
+ * 2つのノードを同時にロックするときは, デッドロックを防ぐため必ず親→子の順に取る
  */
 struct tagNode {
     /* public */
     bool is_leaf;                            // このノードが葉であるか否か
-    const Action action;                     // playerが取った行動
+    const Move move;                         // playerが取った行動
     const int player;                        // 行動actionを取ったプレイヤー
     Heap children;                           // 子ノードを入れるヒープ
     int value_for_heap;                      // 親ノードのヒープ中でソートに用いられる値
@@ -49,9 +78,11 @@ struct tagNode {
 
     /* private */
     volatile size_t index_in_parents_heap_;  // 親ノードのヒープのバッファ中でのインデックス
+    atomic_flag lock_;                       // childrenと子ノードのvalue_for_heapを保護するスピンロック
+    bool is_collapsed_;                      // メモリの上限のために子を捨てて葉に戻されたか否か (value_for_heapと同じロックで保護する)
 };
 
-PNode construct_node(bool is_leaf, Action action, int player, PNode parent, size_t index_in_parents_heap);
+PNode construct_node(NodeArena *arena, bool is_leaf, Move move, int player, PNode parent, size_t index_in_parents_heap);
 
 void destruct_node(PNode node);
 
@@ -61,34 +92,81 @@ size_t get_index_in_parents_heap(PNode self);
 
 bool being_edited(PNode node);
 
+void lock_node(PNode node);
+
+void unlock_node(PNode node);
+
+unsigned long get_lock_contention_count(void);
+
 char *show_children(PNode node);  // for debug
 
 
 /**
  * PNode型のゴミ(解放待ちのポインタ)、及びそれを格納するキューを表すクラス & それらのメソッド
+ * ゴミはエポックに基づいて解放する: 探索者は探索を1回終えるたびに現在のエポックを宣言し直し,
+ * 全ての探索者が現在のエポックを宣言していればエポックを1つ進める.
+ * エポックeでゲーム木から外した木は, エポックがe+2以上になれば (どの探索者からも辿れないので) 解放できる
  */
 typedef struct {
-    PNode root;               // ゴミである木の根
-    size_t timing_of_delete;  // 削除のタイミング (-1なら即時、正なら適時、0は未定義)
+    PNode root;           // ゴミである木の根
+    unsigned long epoch;  // 木をゲーム木から外したときのエポック
 } Garbage;
 
 typedef struct {
-    Garbage *buf;          // ゴミを入れるバッファ
-    size_t max_size;       // キューの最大サイズ
-    size_t start_index;    // リングバッファの開始インデックス
-    size_t end_index;      // リングバッファの終端インデックス
-    pthread_mutex_t lock;  // キューのロック
+    Garbage garbage;    // ゴミ
+    atomic_bool ready;  // garbageを書き込み終えたか否か
+} GarbageSlot;
+
+typedef struct tagGarbageChunk {
+    _Atomic(struct tagGarbageChunk *) next;  // 次のチャンク
+    struct tagGarbageChunk *retired_next;    // 再利用を待つチャンクのリストでの次のチャンク
+    size_t start_position;                   // slots[0]に入る要素の通し番号
+    GarbageSlot slots[GARBAGE_CHUNK_SIZE];
+} GarbageChunk;
+
+/**
+ * 複数のスレッドがロックなしでプッシュし, GarbageCollectorだけがポップするキュー
+ * GARBAGE_CHUNK_SIZE個ずつの要素を入れるチャンクを連結リストでつなぎ, 足りなくなればチャンクを足す (満杯にはならない)
+ */
+typedef struct {
+    /* private (プッシュする側が書き込む) */
+    atomic_size_t end_position_;                    // 次にプッシュする要素の通し番号
+    _Atomic(GarbageChunk *) tail_chunk_;            // 末尾に近いチャンク (後ろにしか進まない)
+    atomic_int pushers_;                            // プッシュの途中のスレッドの数
+    _Atomic(GarbageChunk *) spare_chunk_;           // 使い終わって再利用を待つチャンク
+
+    /* private (ポップする側だけが書き込む) */
+    atomic_size_t start_position_ __attribute__((aligned(64)));
+                                                    // 先頭の要素の通し番号 (これまでにポップした要素の数)
+    atomic_size_t max_depth_;                       // これまでのキューの長さの最大値
+    GarbageChunk *head_chunk_;                      // 先頭の要素が入っているチャンク
+    GarbageChunk *retired_chunks_;                  // 使い終わって, プッシュする側が参照しなくなるのを待つチャンク
 } GarbageQueue;
 
-GarbageQueue construct_garbage_queue(size_t max_size);
+GarbageQueue construct_garbage_queue(void);
 
 void destruct_garbage_queue(GarbageQueue *queue);
 
-/// キューからポップする、ポップする要素がない場合null_garbageを返す
+/// キューの先頭を返す (ポップはしない)、要素がない場合null_garbageを返す、GarbageCollectorだけが呼べる
+Garbage garbage_queue_front(GarbageQueue *queue);
+
+/// キューからポップする、ポップする要素がない場合null_garbageを返す、GarbageCollectorだけが呼べる
 Garbage garbage_queue_pop(GarbageQueue *queue);
 
-/// キューにプッシュする、プッシュに成功したか否かを返す
-bool garbage_queue_push(GarbageQueue *queue, Garbage garbage);
+/// キューにプッシュする (どのスレッドからでも呼べる)
+void garbage_queue_push(GarbageQueue *queue, Garbage garbage);
+
+/// キューに入っている要素の数
+size_t get_garbage_queue_depth(const GarbageQueue *queue);
+
+/// これまでのキューの長さの最大値
+size_t get_garbage_queue_max_depth(const GarbageQueue *queue);
+
+/// これまでにポップした要素の数
+size_t get_garbage_queue_popped(const GarbageQueue *queue);
+
+/// これまでにプッシュした (プッシュの途中のものも含む) 要素の数
+size_t get_garbage_queue_pushed(const GarbageQueue *queue);
 
 bool is_null_garbage(Garbage garbage);
 
@@ -99,17 +177,42 @@ bool is_null_garbage(Garbage garbage);
 typedef struct {
     /* public */
     const Game initial_game_state;          // Gameの最初の状態
+    const bool is_first_player;             // 自分が先手か否か
+    const SearchEngine search_engine;       // 探索者が使う探索の方法
     const Action action_history[MAX_TURN];  // 行動を全てメモしておくための配列
     GarbageQueue garbage_queue;             // ゴミを格納するキュー
-    pthread_mutex_t game_tree_lock;         // ゲーム木の内部ノードの読み書きに関するロック
+    pthread_rwlock_t game_tree_lock;        // ゲーム木の根の付け替えは書き込み, 探索者の読み書きは読み込みで取るロック
+    TranspositionTable transposition_table; // 勝敗が証明された局面を全スレッドで共有する置換表 (ロック不要, ヒープで探索するときだけ確保する)
+    DfpnTable dfpn_table;                   // df-pnの証明数・反証数を全スレッドで共有する置換表 (df-pnを使うときだけ確保する)
+    const int number_of_explorers;          // 探索者の数
+    NodeArena *node_arenas;                 // ノードとヒープのバッファを確保するアリーナ (探索者ごとに1つ, 最後はメインスレッド用)
+    const size_t memory_budget;             // アリーナから確保したままのノードとヒープのバッファの大きさの上限[byte]
+    pthread_mutex_t reclaimer_lock;         // ゴミの解放を待つGarbageCollectorを起こすためのロック
+    pthread_cond_t reclaimer_cond;          // ゴミの解放を待つGarbageCollectorを起こすための条件変数
+    pthread_mutex_t root_change_lock;       // 根の付け替えを待つ探索者を起こすためのロック
+    pthread_cond_t root_change_cond;        // 根の付け替え (または終了の要求) を待つ探索者を起こすための条件変数
 
     /* private */
     volatile size_t action_index_;          // action_historyの要素の個数
     volatile PNode root_;                   // ゲーム木のルート
     volatile bool is_going_to_finish_;      // スレッドを止めるか否か
+    atomic_int writers_waiting_;            // game_tree_lockの書き込みロックを待っているスレッドの数
+    atomic_ulong global_epoch_;             // 現在のエポック (GarbageCollectorだけが進める)
+    atomic_int reclaimer_waiting_;          // GarbageCollectorが何を待って眠っているか
+    atomic_llong dfpn_nodes_;               // df-pnで探索したノード数の合計
+    atomic_flag collapsing_;                // 部分木を畳んでいる探索者がいるか否か (畳むのは一度に1つの探索者だけ)
+    atomic_size_t collapsed_garbage_end_;   // 前に畳んだ部分木を積み終えた時点のget_garbage_queue_pushedの値
+    atomic_llong collapsed_at_ms_;          // 前に部分木を畳んだ時刻[ms]
+    atomic_ulong collapsed_subtrees_;       // メモリの上限のために畳んだ部分木の数の合計
 } SharedResources;
 
-SharedResources *construct_shared_resources(const Game *initial_game_state, bool is_first_player);
+SharedResources *construct_shared_resources(
+        const Game *initial_game_state,
+        bool is_first_player,
+        SearchEngine search_engine,
+        int number_of_explorers,
+        size_t memory_budget
+);
 
 void destruct_shared_resources(SharedResources *self);
 
@@ -119,6 +222,8 @@ PNode get_game_tree_root(SharedResources *self);
 
 bool is_going_to_finish(SharedResources *self);
 
+size_t get_game_tree_bytes(SharedResources *self);
+
 
 /**
  * スレッド1つ分を表すクラスExplorer / GarbageCollectorの宣言
@@ -126,23 +231,26 @@ bool is_going_to_finish(SharedResources *self);
 typedef struct {
     pthread_t thread_id;                // スレッドID
     SharedResources *shared_resources;  // 共有リソースへのポインタ
+    int explorer_index;                 // 探索者の番号
     size_t local_action_index;          // local_gameがどこまで進んでいるかを表すインデックス
     Game local_game;                    // ゲーム木の探索に用いるGameオブジェクト
+    NodeArena *node_arena;              // この探索者がノードを確保するアリーナ
+    atomic_ulong announced_epoch_;      // この探索者が宣言したエポック (0ならゲーム木を参照していない)
 } Explorer, *PExplorer;
 
 typedef struct {
     pthread_t thread_id;                             // スレッドID
     SharedResources *shared_resources;               // 共有リソースへのポインタ
-    const PExplorer p_explorers[NUMBER_OF_THREADS];  // ゲーム木の探索者を格納する配列
+    PExplorer *p_explorers;                          // ゲーム木の探索者を格納する配列
     const int number_of_explorers;                   // ゲーム木の探索者の数
     volatile bool is_going_to_finish_;               // 終了が要求されているか否か
 } GarbageCollector;
 
-Explorer *construct_explorer(SharedResources *shared_resources);
+Explorer *construct_explorer(SharedResources *shared_resources, int explorer_index);
 
 GarbageCollector *construct_garbage_collector(
         SharedResources *shared_resources,
-        const PExplorer p_explorers[NUMBER_OF_THREADS],
+        const PExplorer p_explorers[],
         int number_of_explorers
 );
 
@@ -150,10 +258,10 @@ void destruct_explorer(Explorer *self);
 
 void destruct_garbage_collector(GarbageCollector *self);
 
-/// スレッドに渡す関数であり、共有リソースにあるゲーム木を勝手に拡張する
+/// スレッドに渡す関数であり、共有リソースにあるゲーム木を勝手に拡張する (df-pnの場合は置換表を使って根の勝ちを証明する)
 void *explore(Explorer *self);
 
-/// スレッドに渡す関数であり、共有リソースにあるGarbageQueue中のゴミを解放する
+/// スレッドに渡す関数であり、共有リソースにあるGarbageQueue中のゴミを, どの探索者からも辿れなくなってから解放する
 void *collect_garbage(GarbageCollector *self);
 
 
@@ -164,7 +272,8 @@ typedef struct tagMultiExplorer {
     Action (*get_action)(struct tagMultiExplorer *self, const Game *game);
 
     SharedResources *shared_resources;
-    Explorer *explorers[NUMBER_OF_THREADS];
+    Explorer **explorers;
+    int number_of_explorers;
     GarbageCollector *garbage_collector;
 
     // 暫定的な行動を優先度の高い順に格納する
@@ -176,10 +285,21 @@ typedef struct tagMultiExplorer {
     bool first_call_flag_;
 } MultiExplorer;
 
-MultiExplorer create_multi_explorer(const Game *initial_game_state, bool is_first_player, char *nn_filename);
+MultiExplorer create_multi_explorer(
+        const Game *initial_game_state,
+        bool is_first_player,
+        char *nn_filename,
+        MultiExplorerConfig config
+);
 
 void destruct_multi_explorer(MultiExplorer *self);
 
+/// CPUの数からニューラルネットワークの探索に使う分を除いた, 探索者のスレッドの数の既定値
+int get_default_number_of_threads(void);
+
+/// ゲーム木のノードに使うメモリの上限の既定値[MiB] (物理メモリの半分)
+size_t get_default_memory_budget_mib(void);
+
 /// メインスレッドで動作する関数であり、MultiExplorer.get_actionに代入される
 Action determine_next_action(MultiExplorer *self, const Game *game);
 
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include "NodeArena.h"
+
+
+/*
+スラブ (ARENA_SLAB_SIZE byteの境界に揃えて確保した領域) を同じ大きさのブロックに切り分けて配る.
+スラブの先頭には所有するアリーナとブロックの大きさの種類を書いておくので,
+ブロックのアドレスの下位ビットを落とすだけで, どのアリーナのどの種類のブロックかが分かる.
+
+確保は所有するスレッドだけが行い, local_freeからロックなしで取り出す.
+他のスレッドが解放したブロックはremote_freeにCASで積まれ, local_freeが空になったときに
+所有するスレッドがまとめて (atomic_exchangeで) 引き取る. 取り出しは常にリスト全体なのでABA問題は起きない.
+スラブはアリーナを破棄するまでOSに返さない.
+
+使用中のブロックの大きさは, 配った分 (所有するスレッドだけが書く) と返された分 (どのスレッドからも足す) を
+別々に数えた差として求める. 確保のたびに他のスレッドと同じキャッシュラインを書き換えずに済む.
+*/
+
+#define SLAB_HEADER_SIZE_ 64  // スラブの先頭でSlabHeader_に使う大きさ[byte]
+
+typedef struct {
+    NodeArena *owner;  // スラブを所有するアリーナ
+    int size_class;    // スラブから切り出すブロックの大きさの種類
+    void *next_slab;   // 同じアリーナが確保した次のスラブ
+} SlabHeader_;
+
+_Static_assert(sizeof(SlabHeader_) <= SLAB_HEADER_SIZE_, "SlabHeader_ must fit in SLAB_HEADER_SIZE_");
+_Static_assert((8 << (ARENA_NUMBER_OF_CLASSES - 1)) == ARENA_MAX_BLOCK_SIZE, "inconsistent size classes");
+
+
+static inline int size_class_(size_t size) {
+    // size byte以上のブロックのうち最小の種類
+    assert(0 < size && size <= ARENA_MAX_BLOCK_SIZE);
+    int size_class = 0;
+    while (((size_t) 8 << size_class) < size)
+        ++size_class;
+    return size_class;
+}
+
+
+static inline size_t block_size_(int size_class) {
+    return (size_t) 8 << size_class;
+}
+
+
+static inline SlabHeader_ *slab_of_(void *block) {
+    return (SlabHeader_ *) ((uintptr_t) block & ~((uintptr_t) ARENA_SLAB_SIZE - 1));
+}
+
+
+NodeArena construct_node_arena(int id) {
+    assert(0 <= id && id < MAX_NODE_ARENAS);
+
+    NodeArena arena;
+    memset(&arena, 0, sizeof(NodeArena));
+    arena.id = id;
+    for (int i = 0; i < ARENA_NUMBER_OF_CLASSES; ++i)
+        atomic_init(&arena.remote_free[i], NULL);
+    atomic_init(&arena.number_of_slabs, 0);
+    atomic_init(&arena.allocated_bytes, 0);
+    atomic_init(&arena.freed_bytes, 0);
+    return arena;
+}
+
+
+void destruct_node_arena(NodeArena *arena) {
+    // 確保した全てのスラブを解放する (配ったブロックも全て無効になる)
+    void *slab = arena->slabs;
+    while (slab != NULL) {
+        void *next_slab = ((SlabHeader_ *) slab)->next_slab;
+        free(slab);
+        slab = next_slab;
+    }
+    arena->slabs = NULL;
+    atomic_store_explicit(&arena->number_of_slabs, 0, memory_order_relaxed);
+    atomic_store_explicit(&arena->allocated_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&arena->freed_bytes, 0, memory_order_relaxed);
+}
+
+
+static void *carve_(NodeArena *arena, int size_class) {
+    // 現在のスラブの未使用領域からブロックを切り出す. 足りなければ新しいスラブを確保する
+    size_t size = block_size_(size_class);
+
+    if (arena->unused_end[size_class] - arena->unused_begin[size_class] < (ptrdiff_t) size) {
+        char *slab = (char *) aligned_alloc(ARENA_SLAB_SIZE, ARENA_SLAB_SIZE);
+        assert(slab != NULL);
+
+        SlabHeader_ *header = (SlabHeader_ *) slab;
+        header->owner = arena;
+        header->size_class = size_class;
+        header->next_slab = arena->slabs;
+        arena->slabs = slab;
+        atomic_fetch_add_explicit(&arena->number_of_slabs, 1, memory_order_relaxed);
+
+        arena->unused_begin[size_class] = slab + SLAB_HEADER_SIZE_;
+        arena->unused_end[size_class] = slab + ARENA_SLAB_SIZE;
+    }
+
+    void *block = arena->unused_begin[size_class];
+    arena->unused_begin[size_class] += size;
+    return block;
+}
+
+
+void *arena_alloc(NodeArena *arena, size_t size) {
+    // size byteのブロックを確保する. arenaを所有するスレッドだけが呼べる
+    int size_class = size_class_(size);
+    atomic_store_explicit(&arena->allocated_bytes,
+                          atomic_load_explicit(&arena->allocated_bytes, memory_order_relaxed) + block_size_(size_class),
+                          memory_order_relaxed);
+
+    ArenaBlock *block = arena->local_free[size_class];
+    if (block == NULL) {
+        block = atomic_exchange_explicit(&arena->remote_free[size_class], NULL, memory_order_acquire);
+        if (block == NULL)
+            return carve_(arena, size_class);
+    }
+
+    arena->local_free[size_class] = block->next;
+    return block;
+}
+
+
+static void push_remote_(NodeArena *arena, int size_class, ArenaBlock *head, ArenaBlock *tail) {
+    // head から tail までのリストをarenaのremote_freeに積む (どのスレッドからでも呼べる)
+    ArenaBlock *old_head = atomic_load_explicit(&arena->remote_free[size_class], memory_order_relaxed);
+    do {
+        tail->next = old_head;
+    } while (!atomic_compare_exchange_weak_explicit(
+            &arena->remote_free[size_class], &old_head, head, memory_order_release, memory_order_relaxed));
+}
+
+
+void arena_free(void *block) {
+    // blockを確保したアリーナに返す (どのスレッドからでも呼べる). NULLなら何もしない
+    if (block == NULL)
+        return;
+
+    SlabHeader_ *header = slab_of_(block);
+    push_remote_(header->owner, header->size_class, (ArenaBlock *) block, (ArenaBlock *) block);
+    atomic_fetch_add_explicit(&header->owner->freed_bytes, block_size_(header->size_class), memory_order_relaxed);
+}
+
+
+void arena_batch_free(ArenaBatch *batch, void *block) {
+    // blockをbatchに加える. arena_batch_flushを呼ぶまでアリーナには返らない. NULLなら何もしない
+    if (block == NULL)
+        return;
+
+    SlabHeader_ *header = slab_of_(block);
+    const int id = header->owner->id, size_class = header->size_class;
+    ArenaBlock *b = (ArenaBlock *) block;
+
+    batch->owners[id] = header->owner;
+    batch->bytes[id] += block_size_(size_class);
+    b->next = batch->heads[id][size_class];
+    if (b->next == NULL)
+        batch->tails[id][size_class] = b;
+    batch->heads[id][size_class] = b;
+}
+
+
+void arena_batch_flush(ArenaBatch *batch) {
+    // batchにまとめたブロックを, アリーナとブロックの種類ごとに1回のCASで返す
+    for (int id = 0; id < MAX_NODE_ARENAS; ++id) {
+        if (batch->owners[id] == NULL)
+            continue;
+        for (int size_class = 0; size_class < ARENA_NUMBER_OF_CLASSES; ++size_class) {
+            if (batch->heads[id][size_class] != NULL) {
+                push_remote_(batch->owners[id], size_class,
+                             batch->heads[id][size_class], batch->tails[id][size_class]);
+                batch->heads[id][size_class] = NULL;
+                batch->tails[id][size_class] = NULL;
+            }
+        }
+        atomic_fetch_add_explicit(&batch->owners[id]->freed_bytes, batch->bytes[id], memory_order_relaxed);
+        batch->owners[id] = NULL;
+        batch->bytes[id] = 0;
+    }
+}
+
+
+size_t get_arena_bytes(const NodeArena *arena) {
+    // arenaがOSから確保した領域の大きさ[byte] (どのスレッドからでも呼べる)
+    return atomic_load_explicit(&arena->number_of_slabs, memory_order_relaxed) * (size_t) ARENA_SLAB_SIZE;
+}
+
+
+size_t get_arena_live_bytes(const NodeArena *arena) {
+    // arenaから配って, まだ返されていないブロックの大きさの合計[byte] (どのスレッドからでも呼べる. 目安の値)
+    size_t freed = atomic_load_explicit(&arena->freed_bytes, memory_order_relaxed);
+    size_t allocated = atomic_load_explicit(&arena->allocated_bytes, memory_order_relaxed);
+    return (allocated > freed) ? allocated - freed : 0;
+}
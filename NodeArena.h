@@ -0,0 +1,64 @@
+#ifndef NODEARENA_H
+#define NODEARENA_H
+
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+#define ARENA_SLAB_SIZE          65536  // 1つのスラブの大きさ[byte] (スラブの先頭アドレスはこの値の倍数)
+#define ARENA_NUMBER_OF_CLASSES  9      // ブロックの大きさの種類の数 (8, 16, 32, ..., 2048 byte)
+#define ARENA_MAX_BLOCK_SIZE     2048   // 確保できるブロックの大きさの最大値[byte]
+#define MAX_NODE_ARENAS          64     // 同時に使えるアリーナの数の最大値 (ArenaBatchの大きさを決める)
+
+
+/*********************************
+ * NodeArenaクラスの定義
+ *********************************/
+
+typedef struct tagArenaBlock {      // 空きブロック (空いている間だけ先頭を次の空きブロックへのポインタに使う)
+    struct tagArenaBlock *next;
+} ArenaBlock;
+
+typedef struct {                                              // 1つのスレッドだけが確保に使うスラブアロケータ
+    int id;                                                   // アリーナの番号 (0以上MAX_NODE_ARENAS未満)
+    ArenaBlock *local_free[ARENA_NUMBER_OF_CLASSES];          // 所有するスレッドだけが読み書きする空きブロックのリスト
+    char *unused_begin[ARENA_NUMBER_OF_CLASSES];              // 現在のスラブでまだ切り出していない領域の先頭
+    char *unused_end[ARENA_NUMBER_OF_CLASSES];                // 現在のスラブの末尾
+    void *slabs;                                              // 確保した全てのスラブのリスト
+    atomic_size_t number_of_slabs;                            // 確保したスラブの数
+    atomic_size_t allocated_bytes;                            // これまでに配ったブロックの大きさの合計 (所有するスレッドだけが書き込む)
+    _Atomic(ArenaBlock *) remote_free[ARENA_NUMBER_OF_CLASSES] __attribute__((aligned(64)));
+                                                              // 他のスレッドが返したブロックのリスト (ロックなしで積む)
+    atomic_size_t freed_bytes;                                // これまでに返されたブロックの大きさの合計
+} __attribute__((aligned(64))) NodeArena;
+
+typedef struct {                                                        // 解放するブロックをアリーナごとにまとめて返すためのリスト
+    NodeArena *owners[MAX_NODE_ARENAS];                                 // 番号ごとのアリーナ
+    ArenaBlock *heads[MAX_NODE_ARENAS][ARENA_NUMBER_OF_CLASSES];        // まとめたブロックのリストの先頭
+    ArenaBlock *tails[MAX_NODE_ARENAS][ARENA_NUMBER_OF_CLASSES];        // まとめたブロックのリストの末尾
+    size_t bytes[MAX_NODE_ARENAS];                                      // まとめたブロックの大きさの合計
+} ArenaBatch;
+
+
+/*********************************
+ * NodeArenaクラスのメソッド
+ *********************************/
+
+NodeArena construct_node_arena(int id);
+
+void destruct_node_arena(NodeArena *arena);
+
+void *arena_alloc(NodeArena *arena, size_t size);
+
+void arena_free(void *block);
+
+void arena_batch_free(ArenaBatch *batch, void *block);
+
+void arena_batch_flush(ArenaBatch *batch);
+
+size_t get_arena_bytes(const NodeArena *arena);
+
+size_t get_arena_live_bytes(const NodeArena *arena);
+
+
+#endif  /* NODEARENA_H */
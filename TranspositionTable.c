@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "TranspositionTable.h"
+
+
+/*
+エントリは check = key ^ data と data の2つの64bitの値からなり, それぞれを独立にアトミックに読み書きする.
+2つのスレッドが同じエントリに同時に書き込んで check と data が別々の書き込みのものになっても,
+読み出したときに check ^ data がkeyと一致しないので, そのエントリは単に記録がないものとして扱われる.
+そのため読み書きのどちらにもロックやCASは必要ない.
+
+dataのビット配置: 0-15bit 勝ちの指手, 16-23bit 探索の深さ, 24-25bit 勝敗 (TTResult)
+*/
+
+#define DATA_MOVE_(data)   ((Move) ((data) & 0xFFFF))
+#define DATA_DEPTH_(data)  ((int) (((data) >> 16) & 0xFF))
+#define DATA_RESULT_(data) ((TTResult) (((data) >> 24) & 0x3))
+
+
+static inline uint64_t pack_data_(TTResult result, Move move, int depth) {
+    if (depth < 0)
+        depth = 0;
+    else if (depth > 0xFF)
+        depth = 0xFF;
+    return (uint64_t) move | (uint64_t) depth << 16 | (uint64_t) result << 24;
+}
+
+
+static inline TTBucket *bucket_of_(const TranspositionTable *table, uint64_t key) {
+    return &table->buckets[key & table->mask];
+}
+
+
+TranspositionTable construct_transposition_table(int size_bits) {
+    // 2^size_bits個のエントリを持つ置換表を作る
+    assert(size_bits >= 2);
+
+    uint64_t number_of_buckets = ((uint64_t) 1 << size_bits) / TT_BUCKET_SIZE;
+    TranspositionTable table = {
+            .buckets=(TTBucket *) aligned_alloc(sizeof(TTBucket), number_of_buckets * sizeof(TTBucket)),
+            .mask=number_of_buckets - 1
+    };
+    assert(table.buckets != NULL);
+    clear_transposition_table(&table);
+
+    return table;
+}
+
+
+void destruct_transposition_table(TranspositionTable *table) {
+    free(table->buckets);
+    table->buckets = NULL;
+}
+
+
+void clear_transposition_table(TranspositionTable *table) {
+    // 全てのエントリを空にする (他のスレッドが読み書きしていないときに呼ぶこと)
+    memset(table->buckets, 0, (table->mask + 1) * sizeof(TTBucket));
+}
+
+
+TTResult tt_probe(const TranspositionTable *table, uint64_t key, Move *move, int *depth) {
+    /*
+    局面keyの記録を探し, 勝敗を返す. 記録がなければTT_UNKNOWNを返す.
+    TT_WINのときはmoveに勝ちの指手 (手番側から見た向き) を, depthに記録したときの探索の深さを代入する.
+    */
+    TTBucket *bucket = bucket_of_(table, key);
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t data = atomic_load_explicit(&bucket->entries[i].data, memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&bucket->entries[i].check, memory_order_relaxed);
+        if (data != 0 && (check ^ data) == key) {
+            *move = DATA_MOVE_(data);
+            *depth = DATA_DEPTH_(data);
+            return DATA_RESULT_(data);
+        }
+    }
+    return TT_UNKNOWN;
+}
+
+
+void tt_store(TranspositionTable *table, uint64_t key, TTResult result, Move move, int depth) {
+    /*
+    局面keyの勝敗を記録する. 同じ局面の記録か空きのエントリがあればそこに書き込み,
+    なければバケットの中で探索の深さが最も浅いエントリを置き換える.
+    */
+    assert(result != TT_UNKNOWN);
+
+    TTBucket *bucket = bucket_of_(table, key);
+    int replace_index = 0, min_depth = 0x100;
+    for (int i = 0; i < TT_BUCKET_SIZE; i++) {
+        uint64_t data = atomic_load_explicit(&bucket->entries[i].data, memory_order_relaxed);
+        uint64_t check = atomic_load_explicit(&bucket->entries[i].check, memory_order_relaxed);
+        if (data == 0 || (check ^ data) == key) {
+            replace_index = i;
+            break;
+        }
+        if (DATA_DEPTH_(data) < min_depth) {
+            min_depth = DATA_DEPTH_(data);
+            replace_index = i;
+        }
+    }
+
+    uint64_t data = pack_data_(result, move, depth);
+    atomic_store_explicit(&bucket->entries[replace_index].check, key ^ data, memory_order_relaxed);
+    atomic_store_explicit(&bucket->entries[replace_index].data, data, memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+#ifndef TRANSPOSITIONTABLE_H
+#define TRANSPOSITIONTABLE_H
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "Action.h"
+
+#define TT_BUCKET_SIZE 4  // 1つのバケットに入るエントリの数 (1バケット = 64byte = キャッシュライン1本)
+
+
+/*********************************
+ * TranspositionTableクラスの定義
+ *********************************/
+
+typedef enum {  // 置換表に記録する, 手番側から見た局面の勝敗
+    TT_UNKNOWN,  // 記録がない
+    TT_WIN,      // 手番側の勝ちが証明されている
+    TT_LOSS      // 手番側の負けが証明されている
+} TTResult;
+
+typedef struct {                   // 置換表のエントリ
+    _Atomic uint64_t check;        // 局面のゾブリストハッシュ値とdataの排他的論理和 (書き込みの途中で読まれたことを検出する)
+    _Atomic uint64_t data;         // 勝敗, 証明したときの探索の深さ, 勝ちの指手を詰めた値 (0のときは空き)
+} TTEntry;
+
+typedef struct {
+    TTEntry entries[TT_BUCKET_SIZE];
+} __attribute__((aligned(64))) TTBucket;
+
+typedef struct {          // 複数のスレッドからロックなしで読み書きできる, 固定サイズの置換表
+    TTBucket *buckets;    // バケットの配列
+    uint64_t mask;        // バケットの数 - 1 (バケットの数は2のべき乗)
+} TranspositionTable;
+
+
+/*********************************
+ * TranspositionTableクラスのメソッド
+ *********************************/
+
+TranspositionTable construct_transposition_table(int size_bits);
+
+void destruct_transposition_table(TranspositionTable *table);
+
+void clear_transposition_table(TranspositionTable *table);
+
+TTResult tt_probe(const TranspositionTable *table, uint64_t key, Move *move, int *depth);
+
+void tt_store(TranspositionTable *table, uint64_t key, TTResult result, Move move, int depth);
+
+
+#endif  /* TRANSPOSITIONTABLE_H */
@@ -27,6 +27,16 @@
 #define MAX_TIME         9.9  // 1手あたりの最大思考時間(s)
 
 
+/************************
+ * 指手生成の実装の切り替え
+ ************************/
+
+#define SCAN_GENERATOR      0                    // 盤面の配列を走査する指手生成
+#define BITBOARD_GENERATOR  1                    // ビットボードで指手を1つずつ試す指手生成
+#define PIN_AWARE_GENERATOR 2                    // ビットボードでピンを考慮して合法手のみを作る指手生成
+#define MOVE_GENERATOR      PIN_AWARE_GENERATOR  // get_all_actions等で使用する実装
+
+
 /************************
  * デバッグプリント用の関数
  ************************/
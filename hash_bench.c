@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "Hash.h"
+
+
+/*
+Hashのエンコード・デコードの正しさの検証と速度の計測を行うプログラム.
+ファイルの各局面について, 次が成り立つかを確かめてから, encodeとdecodeの1回あたりの時間を計測する.
+  encode(decode(h)) == h
+  reverse_hash(reverse_hash(h)) == h
+  encode(decodeした盤面を反転したもの) == reverse_hash(h)
+
+使い方: ./hash_bench [オプション]
+  -i <file>  initial_boards_48245.txt 形式 (1行に1局面のHash) のファイル
+             (省略時は neural_network/initial_boards_48245.txt)
+  -r <num>   計測で全局面を繰り返す回数 (省略時は100)
+*/
+
+#define MAX_HASHES 100000  // 読み込む局面の最大数
+
+
+static int load_hashes_(const char *filename, Hash hashes[], int max_hashes) {
+    // 1行に1局面のHashが書かれたファイルからHashを読み込む.
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("cannot open %s\n", filename);
+        exit(1);
+    }
+
+    int len_hashes = 0;
+    Hash h;
+    while (len_hashes < max_hashes && fscanf(fp, "%llu %llu", &h.lower, &h.upper) == 2)
+        hashes[len_hashes++] = h;
+
+    fclose(fp);
+    return len_hashes;
+}
+
+
+static void verify_round_trip_(const Hash hashes[], int len_hashes) {
+    // 全てのHashについて往復変換の結果が一致するかを検証し, 一致しなければ終了する.
+    for (int i = 0; i < len_hashes; i++) {
+        Board b = decode(hashes[i]);
+        Board reversed = b;
+        reverse_board(&reversed);
+
+        const char *failure = NULL;
+        if (!hash_equal(encode(&b), hashes[i]))
+            failure = "encode(decode(h)) != h";
+        else if (!hash_equal(reverse_hash(reverse_hash(hashes[i])), hashes[i]))
+            failure = "reverse_hash(reverse_hash(h)) != h";
+        else if (!hash_equal(encode(&reversed), reverse_hash(hashes[i])))
+            failure = "encode(reverse_board(decode(h))) != reverse_hash(h)";
+
+        if (failure != NULL) {
+            printf("mismatch at line %d: %s (%llu %llu)\n", i + 1, failure, hashes[i].lower, hashes[i].upper);
+            exit(1);
+        }
+    }
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *filename = "neural_network/initial_boards_48245.txt";
+    int repeat = 100;
+
+    int option;
+    while ((option = getopt(argc, argv, "i:r:")) != -1) {
+        switch (option) {
+            case 'i':
+                filename = optarg;
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                if (repeat < 1)
+                    repeat = 1;
+                break;
+            default:
+                puts("usage: hash_bench [-i file] [-r repeat]");
+                return 1;
+        }
+    }
+
+    Hash *hashes = (Hash *) malloc(MAX_HASHES * sizeof(Hash));
+    Board *boards = (Board *) malloc(MAX_HASHES * sizeof(Board));
+    int len_hashes = load_hashes_(filename, hashes, MAX_HASHES);
+    for (int i = 0; i < len_hashes; i++)
+        boards[i] = decode(hashes[i]);
+
+    verify_round_trip_(hashes, len_hashes);
+    printf("round trip: %d positions ok\n", len_hashes);
+
+    // 計算結果を使わないとループごと最適化で消えるので, 全ての結果を畳み込んで出力する.
+    unsigned long long checksum = 0;
+    struct timespec start_time, end_time;
+    long long operations = (long long) len_hashes * repeat;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (int r = 0; r < repeat; r++) {
+        for (int i = 0; i < len_hashes; i++) {
+            Hash h = encode(&boards[i]);
+            checksum += h.lower ^ h.upper;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double encode_seconds = stop_watch(start_time, end_time);
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (int r = 0; r < repeat; r++) {
+        for (int i = 0; i < len_hashes; i++) {
+            Board b = decode(hashes[i]);
+            checksum += (unsigned long long) b.board[i % 5][r % 5] + b.next_stock[FU];
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double decode_seconds = stop_watch(start_time, end_time);
+
+    printf("encode: %.1lf ns/op\n", (operations > 0) ? encode_seconds * 1e9 / operations : 0.0);
+    printf("decode: %.1lf ns/op\n", (operations > 0) ? decode_seconds * 1e9 / operations : 0.0);
+    printf("checksum: %llu\n", checksum);
+
+    free(boards);
+    free(hashes);
+    return 0;
+}
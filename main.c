@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "Game.h"
 #include "MultiThread.h"
 #include "neural_network/neural_network.h"
@@ -68,30 +69,97 @@ User create_user() {
  * 以下main関数
  ******************************/
 
+/*
+使い方: ./main [オプション] <0|1> [heap|dfpn|dfpn-shared]
+  1つ目の引数はユーザーが先手なら0, 後手なら1, 2つ目の引数は探索の方法 (省略時はheap)
+  -t <num>  探索者のスレッドの数 (省略時は環境変数GOGOSHOGI_THREADS, それもなければCPUの数 - NN_THREADS)
+  -p        メインスレッドと探索者をそれぞれ別のCPUに固定する (環境変数GOGOSHOGI_PINが0以外でも固定する)
+  -m <MiB>  ゲーム木のノードに使うメモリの上限 (省略時は環境変数GOGOSHOGI_MEMORY_MIB, それもなければ物理メモリの半分)
+*/
+
+static size_t parse_mib_(const char *str) {
+    // 0以下や数でない文字列は0 (既定値を使う) とする
+    const long mib = atol(str);
+    return (mib > 0) ? (size_t) mib : 0;
+}
+
+
 int main(int argc, char *argv[]) {
-    // 引数の個数をチェック
-    if (argc != 2) {
-        puts("the number of command line arguments must be 2.");
+    MultiExplorerConfig config = {
+            .search_engine=SEARCH_ENGINE_HEAP,
+            .number_of_threads=0,
+            .pins_threads=false,
+            .memory_budget_mib=0
+    };
+
+    // 環境変数で与えた設定は, コマンドラインのオプションで上書きできる
+    const char *threads_env = getenv("GOGOSHOGI_THREADS");
+    if (threads_env != NULL)
+        config.number_of_threads = atoi(threads_env);
+    const char *pin_env = getenv("GOGOSHOGI_PIN");
+    if (pin_env != NULL)
+        config.pins_threads = strcmp(pin_env, "") != 0 && strcmp(pin_env, "0") != 0;
+    const char *memory_env = getenv("GOGOSHOGI_MEMORY_MIB");
+    if (memory_env != NULL)
+        config.memory_budget_mib = parse_mib_(memory_env);
+
+    int option;
+    while ((option = getopt(argc, argv, "t:pm:")) != -1) {
+        switch (option) {
+            case 't':
+                config.number_of_threads = atoi(optarg);
+                break;
+            case 'p':
+                config.pins_threads = true;
+                break;
+            case 'm':
+                config.memory_budget_mib = parse_mib_(optarg);
+                break;
+            default:
+                puts("usage: main [-t threads] [-p] [-m MiB] <0|1> [heap|dfpn|dfpn-shared]");
+                return -1;
+        }
+    }
+
+    // 引数の個数をチェック (2つ目の引数は探索の方法で, 省略できる)
+    const int number_of_arguments = argc - optind;
+    if (number_of_arguments != 1 && number_of_arguments != 2) {
+        puts("the number of command line arguments must be 1 or 2.");
         return -1;
     }
 
     // 先手か後手か
     bool is_user_first;
-    if (!strcmp(argv[1], "0")) {
+    if (!strcmp(argv[optind], "0")) {
         is_user_first = true;
-    } else if (!strcmp(argv[1], "1")) {
+    } else if (!strcmp(argv[optind], "1")) {
         is_user_first = false;
     } else {
         puts("invalid command line argument.");
         return -1;
     }
 
+    // 探索の方法 (heap: ゲーム木をヒープで展開する, dfpn: 1スレッドのdf-pn, dfpn-shared: 置換表を共有する並列df-pn)
+    if (number_of_arguments == 2) {
+        const char *engine = argv[optind + 1];
+        if (!strcmp(engine, "heap")) {
+            config.search_engine = SEARCH_ENGINE_HEAP;
+        } else if (!strcmp(engine, "dfpn")) {
+            config.search_engine = SEARCH_ENGINE_DFPN;
+        } else if (!strcmp(engine, "dfpn-shared")) {
+            config.search_engine = SEARCH_ENGINE_DFPN_SHARED;
+        } else {
+            puts("invalid search engine (heap, dfpn or dfpn-shared).");
+            return -1;
+        }
+    }
+
     // 初期化済みのゲームクラスを作る
     Game game = create_game(MAX_TURN);
 
     // プレイヤーの宣言
     char *path = "neural_network/nn_128x2_64x2_32x2_2.txt";
-    MultiExplorer ai = create_multi_explorer(&game, !is_user_first, path);
+    MultiExplorer ai = create_multi_explorer(&game, !is_user_first, path, config);
     User user = create_user();
 
     // ゲームを行い、勝者を決める
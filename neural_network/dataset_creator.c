@@ -103,8 +103,8 @@ int create_dataset(PlayerInterface *first, PlayerInterface *second, char dataset
         // 初期化済みのゲームクラスを作る.
         Game game = create_game(MAX_TURN);
         if (initial_boards != NULL) {
-            game.current = decode(initial_boards[rand()%len_initial_boards]);
-            game.history[0] = reverse_hash(encode(&game.current));
+            Board initial_board = decode(initial_boards[rand()%len_initial_boards]);
+            set_initial_board(&game, &initial_board);
         }
 
         // 対戦を行う.
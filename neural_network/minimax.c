@@ -14,7 +14,7 @@ typedef struct __gtnode {
     struct __gtnode *parent;
     int len_children;
     struct __gtnode **children;
-    Action action;
+    Move move;
 } GameTreeNode;
 
 
@@ -82,7 +82,7 @@ GameTreeNode *queue_pop(Queue *self) {
 }
 
 
-void gtnode_init(GameTreeNode *self, const Board *b, bool is_first, GameTreeNode *parent, Action action, NeuralNetwork *nn, int max_children) {
+void gtnode_init(GameTreeNode *self, const Board *b, bool is_first, GameTreeNode *parent, Move move, NeuralNetwork *nn, int max_children) {
     // GameTreeNodeを初期化する.
     // 子ノードの探索は行わない.
     self->b = *b;
@@ -91,7 +91,7 @@ void gtnode_init(GameTreeNode *self, const Board *b, bool is_first, GameTreeNode
     self->parent = parent;
     self->len_children = -1; // 探索前は-1に設定する.
     self->children = malloc(max_children * sizeof(GameTreeNode *));
-    self->action = action;
+    self->move = move;
 }
 
 
@@ -120,15 +120,15 @@ void gtnode_expand(GameTreeNode *self, NeuralNetwork *nn, int max_children) {
     // BeamNode の子を探索する.
 
     // 子ノードを取得する.
-    Action all_actions[LEN_ACTIONS];
-    int len_children = get_useful_actions(&self->b, all_actions);
+    Move all_moves[LEN_ACTIONS];
+    int len_children = get_useful_moves(&self->b, all_moves);
     GameTreeNode **children = malloc(len_children * sizeof(GameTreeNode *));
     for (int i = 0; i < len_children; i++) {
         Board b = self->b;
-        update_board(&b, all_actions[i]);
+        update_board(&b, move_to_action(all_moves[i]));
         reverse_board(&b);
         GameTreeNode *child = malloc(sizeof(GameTreeNode));
-        gtnode_init(child, &b, 1 - self->is_first, self, all_actions[i], nn, max_children);
+        gtnode_init(child, &b, 1 - self->is_first, self, all_moves[i], nn, max_children);
         children[i] = child;
     }
 
@@ -215,8 +215,7 @@ Action game_tree_search(NNAI *self, const Game *game) {
 
     // 根を設定する.
     GameTreeNode *root = malloc(sizeof(GameTreeNode));
-    Action action;
-    gtnode_init(root, &game->current, game->turn % 2, NULL, action, &self->nn, max_children);
+    gtnode_init(root, &game->current, game->turn % 2, NULL, NULL_MOVE, &self->nn, max_children);
     queue_push(&que, root);
 
     // BFSを行う.
@@ -242,11 +241,11 @@ Action game_tree_search(NNAI *self, const Game *game) {
 
     // 最善手を選択する.
     int idx = gtnode_argmin(root->children, root->len_children);
-    Action res = root->children[idx]->action;
+    Action res = move_to_action(root->children[idx]->move);
 
     // 各指手の評価値を出力する.
     for (int i = 0; i < root->len_children; i++) {
-        Action action = root->children[i]->action;
+        Action action = move_to_action(root->children[i]->move);
         if (game->turn % 2 == 0)
             reverse_action(&action);
         char buffer[32];
@@ -274,14 +273,14 @@ NNAI create_minimax_ai(char load_file_name[]) {
 }
 
 
-int get_prioritized_actions(NeuralNetwork *nn, const Game *game, Action return_actions[LEN_ACTIONS]) {
+int get_prioritized_actions(NeuralNetwork *nn, const Game *game, Action return_actions[LEN_ACTIONS], double max_time) {
     // Mini-Max法によって指手の優劣をつけ、その順にソートした行動の配列を返す.
     // 戻り値は配列の長さである
+    // max_time[秒]が経過したら探索を打ち切る (同じ手番で他の探索にも時間を使う場合は, その分を引いて渡す)
 
     // 時間計測の準備をする.
     struct timespec start_time, tmp_time;
     clock_gettime(CLOCK_REALTIME, &start_time);
-    double max_time = MAX_TIME * 0.95;  // 念の為9秒に変えました->やっぱり戻した
 
     // パラメータを定義する.
     int max_children = 4; // 分岐数の最大値. これ以上の分岐は評価関数によってすぐに枝刈りを行う.
@@ -293,8 +292,7 @@ int get_prioritized_actions(NeuralNetwork *nn, const Game *game, Action return_a
 
     // 根を設定する.
     GameTreeNode *root = malloc(sizeof(GameTreeNode));
-    Action action;
-    gtnode_init(root, &game->current, game->turn % 2, NULL, action, nn, max_children);
+    gtnode_init(root, &game->current, game->turn % 2, NULL, NULL_MOVE, nn, max_children);
     queue_push(&que, root);
 
     // BFSを行う.
@@ -322,11 +320,11 @@ int get_prioritized_actions(NeuralNetwork *nn, const Game *game, Action return_a
     qsort(root->children, root->len_children, sizeof(GameTreeNode *), (void *) gtnode_comparison);
     int res = root->len_children;
     for (int i = 0; i < root->len_children; ++i)
-        return_actions[i] = root->children[i]->action;
+        return_actions[i] = move_to_action(root->children[i]->move);
 
     // 各指手の評価値を出力する.
     for (int i = 0; i < root->len_children; i++) {
-        Action action = root->children[i]->action;
+        Action action = move_to_action(root->children[i]->move);
         if (game->turn % 2 == 0)
             reverse_action(&action);
         char buffer[32];
@@ -53,7 +53,7 @@ void nn_free(NeuralNetwork *nn);
 
 void nn_load_model(NeuralNetwork *nn, char load_file[]);
 
-int get_prioritized_actions(NeuralNetwork *nn, const Game *game, Action return_actions[LEN_ACTIONS]);
+int get_prioritized_actions(NeuralNetwork *nn, const Game *game, Action return_actions[LEN_ACTIONS], double max_time);
 
 
 typedef struct tagNNAI {
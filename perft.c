@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "Game.h"
+#include "BitBoard.h"
+
+
+/*
+指手生成の速度の計測と正しさの検証を行うプログラム.
+局面から深さdepthまでの全ての指手を辿り, 末端の局面の数 (ノード数) を数える.
+
+使い方: ./perft [オプション] <depth>
+  -i <file>  initial_boards_48245.txt 形式 (1行に1局面のHash) のファイルの各局面から数える
+  -m <file>  memo/test_data.txt 形式 (1行に1手の棋譜) のファイルに現れる各局面から数える
+  -n <num>   ファイルから読み込む局面の最大数
+  -t         千日手を考慮する (Gameとget_all_moves_with_tfrを用いる)
+  -g <name>  千日手を考慮しない場合の指手生成の実装 (scan, bitboard, pin, picker)
+  -v         全ての実装で指手の集合が一致するかを各局面で検証する
+  -d         最初の局面の各指手ごとのノード数を出力する (divide)
+-i, -mのいずれも指定しないときは初期局面から数える.
+*/
+
+#define MAX_POSITIONS 100000  // 読み込む局面の最大数
+
+typedef enum {
+    GEN_SCAN,      // get_all_actions_by_scan
+    GEN_BITBOARD,  // get_all_moves_bb
+    GEN_PIN,       // get_legal_moves_bb
+    GEN_PICKER,    // MovePicker
+    NUMBER_OF_GENERATORS
+} Generator;
+
+static const char *generator_names[NUMBER_OF_GENERATORS] = {"scan", "bitboard", "pin", "picker"};
+
+
+static int generate_(const Board *b, Generator generator, Move moves[LEN_ACTIONS]) {
+    // generatorで指定された実装で, 千日手を考慮せずに選択可能な指手を全列挙する.
+    switch (generator) {
+        case GEN_SCAN: {
+            Action actions[LEN_ACTIONS];
+            int len_actions = get_all_actions_by_scan(b, actions);
+            for (int i = 0; i < len_actions; i++)
+                moves[i] = action_to_move(actions[i]);
+            return len_actions;
+        }
+        case GEN_BITBOARD:
+            return get_all_moves_bb(b, moves);
+        case GEN_PIN:
+            return get_legal_moves_bb(b, moves);
+        default: {
+            MovePicker picker;
+            init_move_picker(&picker, b);
+            int len_moves = 0;
+            for (Move move = next_move(&picker); move != NULL_MOVE; move = next_move(&picker))
+                moves[len_moves++] = move;
+            return len_moves;
+        }
+    }
+}
+
+
+static int compare_moves_(const void *a, const void *b) {
+    return (int) *(const Move *) a - (int) *(const Move *) b;
+}
+
+
+static void verify_generators_(const Board *b) {
+    // 全ての実装で列挙される指手の集合が一致するかを検証し, 一致しなければ終了する.
+    Move expected[LEN_ACTIONS];
+    int len_expected = generate_(b, GEN_SCAN, expected);
+    qsort(expected, len_expected, sizeof(Move), compare_moves_);
+
+    for (Generator generator = GEN_SCAN + 1; generator < NUMBER_OF_GENERATORS; generator++) {
+        Move moves[LEN_ACTIONS];
+        int len_moves = generate_(b, generator, moves);
+        qsort(moves, len_moves, sizeof(Move), compare_moves_);
+        if (len_moves != len_expected || memcmp(moves, expected, len_moves * sizeof(Move)) != 0) {
+            printf("mismatch: %s generates %d moves, %s generates %d moves\n",
+                   generator_names[GEN_SCAN], len_expected, generator_names[generator], len_moves);
+            print_board_for_debug(b);
+            exit(1);
+        }
+    }
+}
+
+
+static long long perft_raw_(const Board *b, int depth, Generator generator, bool verify) {
+    // 千日手を考慮せずに, 盤面bから深さdepthの局面の数を数える.
+    if (verify)
+        verify_generators_(b);
+    if (depth == 0)
+        return 1;
+
+    Move moves[LEN_ACTIONS];
+    int len_moves = generate_(b, generator, moves);
+    if (depth == 1 && !verify)
+        return len_moves;
+
+    long long nodes = 0;
+    for (int i = 0; i < len_moves; i++) {
+        Board next = *b;
+        update_board(&next, move_to_action(moves[i]));
+        reverse_board(&next);
+        nodes += perft_raw_(&next, depth - 1, generator, verify);
+    }
+    return nodes;
+}
+
+
+static long long perft_tfr_(Game *game, int depth) {
+    // 千日手を考慮して, gameの現在の局面から深さdepthの局面の数を数える.
+    if (depth == 0)
+        return 1;
+
+    Move moves[LEN_ACTIONS];
+    int len_moves = get_all_moves_with_tfr(game, moves);
+    if (depth == 1)
+        return len_moves;
+
+    long long nodes = 0;
+    for (int i = 0; i < len_moves; i++) {
+        do_move(game, moves[i]);
+        nodes += perft_tfr_(game, depth - 1);
+        undo_action(game);
+    }
+    return nodes;
+}
+
+
+static long long perft_(Game *game, int depth, bool tfr, Generator generator, bool verify, bool divide) {
+    // gameの現在の局面から深さdepthの局面の数を数える.
+    // divideが真のときは, 最初の指手ごとのノード数も出力する.
+    if (!divide || depth == 0)
+        return tfr ? perft_tfr_(game, depth) : perft_raw_(&game->current, depth, generator, verify);
+
+    Move moves[LEN_ACTIONS];
+    int len_moves = tfr ? get_all_moves_with_tfr(game, moves) : generate_(&game->current, generator, moves);
+    if (verify && !tfr)
+        verify_generators_(&game->current);
+
+    long long nodes = 0;
+    for (int i = 0; i < len_moves; i++) {
+        do_move(game, moves[i]);
+        long long child_nodes = tfr ? perft_tfr_(game, depth - 1)
+                                    : perft_raw_(&game->current, depth - 1, generator, verify);
+        undo_action(game);
+
+        // 先手から見た指手として出力する.
+        char buf[32];
+        Action action = move_to_action(moves[i]);
+        if (game->turn % 2 == 0)
+            reverse_action(&action);
+        action_to_string(action, buf);
+        printf("%s: %lld\n", buf, child_nodes);
+        nodes += child_nodes;
+    }
+    return nodes;
+}
+
+
+static int load_initial_boards_(const char *filename, Game positions[], int max_positions, int depth) {
+    // 1行に1局面のHashが書かれたファイルから局面を読み込む. 各局面は先手の手番とする.
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("cannot open %s\n", filename);
+        exit(1);
+    }
+
+    int len_positions = 0;
+    Hash h;
+    while (len_positions < max_positions && fscanf(fp, "%llu %llu", &h.lower, &h.upper) == 2) {
+        Game game = create_game(MAX_TURN + depth);
+        Board b = decode(h);
+        set_initial_board(&game, &b);
+        positions[len_positions++] = game;
+    }
+
+    fclose(fp);
+    return len_positions;
+}
+
+
+static int load_game_records_(const char *filename, Game positions[], int max_positions, int depth) {
+    /*
+    memo/test_data.txt 形式のファイルに書かれた指手を初期局面から順に指し, 現れた局面を全て読み込む.
+    指手は手番側から見た向き (Boardと同じ向き) で書かれているものとする.
+    指手として解釈できない行は読み飛ばし, 「テスト」や「新しい盤面」を含む行で初期局面に戻る.
+    反則手は指さずに標準エラー出力に報告する.
+    */
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL) {
+        printf("cannot open %s\n", filename);
+        exit(1);
+    }
+
+    Game game = create_game(MAX_TURN + depth);
+    int len_positions = 0;
+    positions[len_positions++] = clone(&game, MAX_TURN + depth);
+
+    char line[256];
+    while (len_positions < max_positions && fgets(line, sizeof(line), fp) != NULL) {
+        if (strstr(line, "テスト") != NULL || strstr(line, "新しい盤面") != NULL) {
+            destruct_game(&game);
+            game = create_game(MAX_TURN + depth);
+            continue;
+        }
+
+        line[strcspn(line, "\r\n")] = '\0';
+        Action action;
+        if (!string_to_action(line, &action))
+            continue;
+        if (game.turn >= MAX_TURN || !is_possible_action_with_tfr(&game, action)) {
+            fprintf(stderr, "skipped illegal action %s at turn %d\n", line, game.turn);
+            continue;
+        }
+
+        do_action(&game, action);
+        positions[len_positions++] = clone(&game, MAX_TURN + depth);
+    }
+
+    destruct_game(&game);
+    fclose(fp);
+    return len_positions;
+}
+
+
+int main(int argc, char *argv[]) {
+    const char *initial_boards_file = NULL, *game_records_file = NULL;
+    int max_positions = MAX_POSITIONS;
+    bool tfr = false, verify = false, divide = false;
+    Generator generator = GEN_PIN;
+
+    int option;
+    while ((option = getopt(argc, argv, "i:m:n:tg:vd")) != -1) {
+        switch (option) {
+            case 'i':
+                initial_boards_file = optarg;
+                break;
+            case 'm':
+                game_records_file = optarg;
+                break;
+            case 'n':
+                max_positions = atoi(optarg);
+                if (max_positions < 1 || MAX_POSITIONS < max_positions)
+                    max_positions = MAX_POSITIONS;
+                break;
+            case 't':
+                tfr = true;
+                break;
+            case 'g':
+                for (generator = 0; generator < NUMBER_OF_GENERATORS; generator++) {
+                    if (strcmp(optarg, generator_names[generator]) == 0)
+                        break;
+                }
+                if (generator == NUMBER_OF_GENERATORS) {
+                    printf("unknown generator: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'v':
+                verify = true;
+                break;
+            case 'd':
+                divide = true;
+                break;
+            default:
+                puts("usage: perft [-i file | -m file] [-n num] [-t] [-g scan|bitboard|pin|picker] [-v] [-d] <depth>");
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        puts("usage: perft [-i file | -m file] [-n num] [-t] [-g scan|bitboard|pin|picker] [-v] [-d] <depth>");
+        return 1;
+    }
+    int depth = atoi(argv[optind]);
+
+    // 局面を用意する.
+    Game *positions = (Game *) malloc(max_positions * sizeof(Game));
+    int len_positions;
+    if (initial_boards_file != NULL) {
+        len_positions = load_initial_boards_(initial_boards_file, positions, max_positions, depth);
+    } else if (game_records_file != NULL) {
+        len_positions = load_game_records_(game_records_file, positions, max_positions, depth);
+    } else {
+        positions[0] = create_game(MAX_TURN + depth);
+        len_positions = 1;
+    }
+
+    // 数える.
+    struct timespec start_time, end_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    long long nodes = 0;
+    for (int i = 0; i < len_positions; i++) {
+        if (tfr && !divide) {
+            // Gameの内部の盤面だけで数えられるので, 探索と同じく盤面の反転とHashの記録を省略する
+            set_fixed_orientation(&positions[i], true);
+            set_hash_recording(&positions[i], false);
+        }
+        nodes += perft_(&positions[i], depth, tfr, generator, verify, divide && len_positions == 1);
+        destruct_game(&positions[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    double seconds = stop_watch(start_time, end_time);
+
+    printf("mode: %s, positions: %d, depth: %d\n", tfr ? "tfr" : generator_names[generator], len_positions, depth);
+    printf("nodes: %lld\n", nodes);
+    printf("time: %.3lf s (%.0lf nodes/s)\n", seconds, (seconds > 0) ? nodes / seconds : 0.0);
+    if (verify)
+        puts(tfr ? "verification is only done without -t" : "all generators agree");
+
+    free(positions);
+    return 0;
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "gamedef.h"
+
+
+/*
+ビルド時に実行され, ビットボードで用いる表をヘッダーファイルとして出力するプログラム.
+使い方: ./table_generator <出力するファイル名>
+
+直線的なききの表は, ききに関係するマスの駒の配置 (occupied & MASK) に
+MAGICを掛けた値の上位ATTACK_INDEX_BITSビットを添字として引く.
+5×5の盤面では関係するマスは高々6個なので, 各マスの表は64要素で足りる.
+*/
+
+#define ATTACK_INDEX_BITS 6  // 直線的なききの表の添字のビット数
+#define ATTACK_TABLE_SIZE (1 << ATTACK_INDEX_BITS)
+
+
+// 手番側の駒の1歩の動き (Board.c の move_matrix_x, move_matrix_y と同じ動き, 相手側は符号を反転する)
+static const int step_dx[MAX_PIECE_NUMBER + 1][8] = {
+        {},                           // EMPTY
+        {-1},                         // 歩
+        {},                           // 角 (直線的な動きのみ)
+        {},                           // 飛 (直線的な動きのみ)
+        {-1, -1, -1, 1, 1},           // 銀
+        {-1, -1, -1, 0, 0, 1},        // 金
+        {-1, -1, -1, 0, 0, 1, 1, 1},  // 王
+        {-1, -1, -1, 0, 0, 1},        // と
+        {-1, 1,  0,  0},              // 馬 - 角
+        {-1, -1, 1,  1},              // 龍 - 飛
+        {-1, -1, -1, 0, 0, 1}         // 全
+};
+
+static const int step_dy[MAX_PIECE_NUMBER + 1][8] = {
+        {},                            // EMPTY
+        {0},                           // 歩
+        {},                            // 角
+        {},                            // 飛
+        {-1, 0, 1,  -1, 1},            // 銀
+        {-1, 0, 1,  -1, 1, 0},         // 金
+        {-1, 0, 1,  -1, 1, -1, 0, 1},  // 王
+        {-1, 0, 1,  -1, 1, 0},         // と
+        {0,  0, -1, 1},                // 馬 - 角
+        {-1, 1, -1, 1},                // 龍 - 飛
+        {-1, 0, 1,  -1, 1, 0},         // 全
+};
+
+static const int step_length[MAX_PIECE_NUMBER + 1] = {0, 1, 0, 0, 5, 6, 8, 6, 4, 4, 6};
+
+static const int diagonal_dx[4] = {-1, -1, 1, 1};
+static const int diagonal_dy[4] = {-1, 1, -1, 1};
+static const int orthogonal_dx[4] = {-1, 1, 0, 0};
+static const int orthogonal_dy[4] = {0, 0, -1, 1};
+
+
+static bool on_board(int x, int y) {
+    return 0 <= x && x < 5 && 0 <= y && y < 5;
+}
+
+
+static uint32_t step_attacks(int color, int piece, int square) {
+    int sign = (color == 0) ? 1 : -1;
+    uint32_t attacks = 0;
+    for (int k = 0; k < step_length[piece]; k++) {
+        int x = square / 5 + sign * step_dx[piece][k];
+        int y = square % 5 + sign * step_dy[piece][k];
+        if (on_board(x, y))
+            attacks |= (uint32_t) 1 << (5 * x + y);
+    }
+    return attacks;
+}
+
+
+static uint32_t slide_attacks(int square, const int dx[4], const int dy[4], uint32_t occupied) {
+    // 他の駒とぶつかったマスは含み, その先のマスは含まない.
+    uint32_t attacks = 0;
+    for (int k = 0; k < 4; k++) {
+        int x = square / 5 + dx[k];
+        int y = square % 5 + dy[k];
+        while (on_board(x, y)) {
+            attacks |= (uint32_t) 1 << (5 * x + y);
+            if (occupied & ((uint32_t) 1 << (5 * x + y)))
+                break;
+            x += dx[k];
+            y += dy[k];
+        }
+    }
+    return attacks;
+}
+
+
+static uint32_t relevant_mask(int square, const int dx[4], const int dy[4]) {
+    // ききに関係するマスの集合を返す.
+    // 各方向の盤端のマスは, 駒があってもなくてもききが変わらないので含めない.
+    uint32_t mask = 0;
+    for (int k = 0; k < 4; k++) {
+        int x = square / 5 + dx[k];
+        int y = square % 5 + dy[k];
+        while (on_board(x + dx[k], y + dy[k])) {
+            mask |= (uint32_t) 1 << (5 * x + y);
+            x += dx[k];
+            y += dy[k];
+        }
+    }
+    return mask;
+}
+
+
+static uint32_t between(int square1, int square2) {
+    // square1とsquare2が縦横斜めのいずれかに並んでいるとき, その間のマスの集合を返す.
+    // 並んでいないときは空集合を返す.
+    int dx = square2 / 5 - square1 / 5;
+    int dy = square2 % 5 - square1 % 5;
+    if (square1 == square2 || (dx != 0 && dy != 0 && dx != dy && dx != -dy))
+        return 0;
+
+    int step_x = (dx > 0) - (dx < 0);
+    int step_y = (dy > 0) - (dy < 0);
+    uint32_t squares = 0;
+    for (int x = square1 / 5 + step_x, y = square1 % 5 + step_y; 5 * x + y != square2; x += step_x, y += step_y)
+        squares |= (uint32_t) 1 << (5 * x + y);
+    return squares;
+}
+
+
+static uint64_t random_u64(void) {
+    // 出力を毎回同じにするため, 種を固定したxorshiftを用いる.
+    static uint64_t state = 88172645463325252ULL;
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+
+static uint64_t find_magic(int square, const int dx[4], const int dy[4], uint32_t mask,
+                           uint32_t table[ATTACK_TABLE_SIZE]) {
+    // 関係するマスの駒の配置の全パターンについて, 添字が衝突しないMAGICを探す.
+    // ききが等しい配置どうしは同じ添字になっても構わない.
+
+    uint32_t occupancies[ATTACK_TABLE_SIZE], attacks[ATTACK_TABLE_SIZE];
+    int len_patterns = 0;
+    uint32_t occupied = 0;
+    do {  // maskの部分集合を全て列挙する
+        occupancies[len_patterns] = occupied;
+        attacks[len_patterns++] = slide_attacks(square, dx, dy, occupied);
+        occupied = (occupied - mask) & mask;
+    } while (occupied != 0);
+
+    for (;;) {
+        uint64_t magic = random_u64() & random_u64() & random_u64();
+        bool used[ATTACK_TABLE_SIZE] = {};
+        bool success = true;
+
+        for (int i = 0; i < len_patterns && success; i++) {
+            int index = (int) (((uint64_t) occupancies[i] * magic) >> (64 - ATTACK_INDEX_BITS));
+            if (!used[index]) {
+                used[index] = true;
+                table[index] = attacks[i];
+            } else if (table[index] != attacks[i]) {
+                success = false;
+            }
+        }
+
+        if (success)
+            return magic;
+    }
+}
+
+
+static void print_slider_tables(FILE *fp, const char *name, const int dx[4], const int dy[4]) {
+    uint32_t masks[25];
+    uint64_t magics[25];
+    uint32_t tables[25][ATTACK_TABLE_SIZE] = {};
+
+    for (int square = 0; square < 25; square++) {
+        masks[square] = relevant_mask(square, dx, dy);
+        magics[square] = find_magic(square, dx, dy, masks[square], tables[square]);
+    }
+
+    fprintf(fp, "static const uint32_t %s_MASKS[25] = {", name);
+    for (int square = 0; square < 25; square++)
+        fprintf(fp, "%s0x%07xu", (square == 0) ? "\n        " : (square % 5) ? ", " : ",\n        ", masks[square]);
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "static const uint64_t %s_MAGICS[25] = {", name);
+    for (int square = 0; square < 25; square++)
+        fprintf(fp, "%s0x%016llxull", (square == 0) ? "\n        " : (square % 3) ? ", " : ",\n        ",
+                (unsigned long long) magics[square]);
+    fprintf(fp, "\n};\n\n");
+
+    fprintf(fp, "static const uint32_t %s_ATTACKS[25][%d] = {\n", name, ATTACK_TABLE_SIZE);
+    for (int square = 0; square < 25; square++) {
+        fprintf(fp, "        {");
+        for (int i = 0; i < ATTACK_TABLE_SIZE; i++)
+            fprintf(fp, "%s0x%07xu", (i == 0) ? "" : (i % 8) ? ", " : ",\n         ", tables[square][i]);
+        fprintf(fp, "},\n");
+    }
+    fprintf(fp, "};\n\n");
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        puts("usage: table_generator <output file>");
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[1], "w");
+    if (fp == NULL) {
+        printf("cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(fp, "/* table_generator.c によってビルド時に生成されたファイル. 編集しないこと. */\n\n");
+    fprintf(fp, "#ifndef GENERATED_TABLES_H\n#define GENERATED_TABLES_H\n\n\n");
+    fprintf(fp, "#include <stdint.h>\n\n");
+    fprintf(fp, "#define ATTACK_INDEX_SHIFT %d  // 直線的なききの表の添字を求める際のシフト量\n\n\n", 64 - ATTACK_INDEX_BITS);
+
+    // 1歩で動けるマスの表 (STEP_ATTACKS[手番側/相手側][駒][マス])
+    fprintf(fp, "static const uint32_t STEP_ATTACKS[2][%d][25] = {\n", MAX_PIECE_NUMBER + 1);
+    for (int color = 0; color < 2; color++) {
+        fprintf(fp, "        {\n");
+        for (int piece = 0; piece <= MAX_PIECE_NUMBER; piece++) {
+            fprintf(fp, "                {");
+            for (int square = 0; square < 25; square++)
+                fprintf(fp, "%s0x%07xu", (square == 0) ? "" : (square % 5) ? ", " : ",\n                 ",
+                        step_attacks(color, piece, square));
+            fprintf(fp, "},\n");
+        }
+        fprintf(fp, "        },\n");
+    }
+    fprintf(fp, "};\n\n");
+
+    // 2マスの間のマスの表 (BETWEEN[マス][マス])
+    fprintf(fp, "static const uint32_t BETWEEN[25][25] = {\n");
+    for (int square1 = 0; square1 < 25; square1++) {
+        fprintf(fp, "        {");
+        for (int square2 = 0; square2 < 25; square2++)
+            fprintf(fp, "%s0x%07xu", (square2 == 0) ? "" : (square2 % 5) ? ", " : ",\n         ",
+                    between(square1, square2));
+        fprintf(fp, "},\n");
+    }
+    fprintf(fp, "};\n\n");
+
+    // 直線的なききの表 (角, 馬の斜め方向と飛, 龍の縦横方向)
+    print_slider_tables(fp, "DIAGONAL", diagonal_dx, diagonal_dy);
+    print_slider_tables(fp, "ORTHOGONAL", orthogonal_dx, orthogonal_dy);
+
+    // ゾブリストハッシュの乱数表 (先手を0, 後手を1とし, 先手から見た向きのマスで引く)
+    fprintf(fp, "// ゾブリストハッシュの乱数 (ZOBRIST_BOARD[先手/後手][駒][マス], ZOBRIST_STOCK[先手/後手][駒][枚数])\n");
+    fprintf(fp, "static const uint64_t ZOBRIST_BOARD[2][%d][25] = {\n", MAX_PIECE_NUMBER + 1);
+    for (int color = 0; color < 2; color++) {
+        fprintf(fp, "        {\n");
+        for (int piece = 0; piece <= MAX_PIECE_NUMBER; piece++) {
+            fprintf(fp, "                {");
+            for (int square = 0; square < 25; square++)
+                fprintf(fp, "%s0x%016llxull", (square == 0) ? "" : (square % 3) ? ", " : ",\n                 ",
+                        (piece == EMPTY) ? 0ull : (unsigned long long) random_u64());
+            fprintf(fp, "},\n");
+        }
+        fprintf(fp, "        },\n");
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "static const uint64_t ZOBRIST_STOCK[2][6][3] = {\n");
+    for (int color = 0; color < 2; color++) {
+        fprintf(fp, "        {\n");
+        for (int piece = 0; piece < 6; piece++) {
+            fprintf(fp, "                {");
+            for (int count = 0; count < 3; count++)
+                fprintf(fp, "%s0x%016llxull", (count == 0) ? "" : ", ",
+                        (count == 0) ? 0ull : (unsigned long long) random_u64());
+            fprintf(fp, "},\n");
+        }
+        fprintf(fp, "        },\n");
+    }
+    fprintf(fp, "};\n\n");
+
+    fprintf(fp, "#define ZOBRIST_SIDE 0x%016llxull  // 後手の手番であることを表す乱数\n\n",
+            (unsigned long long) random_u64());
+
+    fprintf(fp, "\n#endif  /* GENERATED_TABLES_H */\n");
+    fclose(fp);
+
+    return 0;
+}